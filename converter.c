@@ -0,0 +1,1335 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ */
+
+#define LIBXML_SCHEMAS_ENABLED
+#include "converter.h"
+
+#include "cstring.h"
+#include "htable.h"
+#include "json.h"
+#include "jsontape.h"
+#include "util.h"
+#include "parsexsd.h"
+#include "scalar.h"
+#include "xmlinput.h"
+#include "whitespace.h"
+#include "xmlstream.h"
+#include "xsdtable.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <string.h>
+
+#include <libxml/parser.h>
+#include <libxml/xmlschemastypes.h>
+#include <libxml/schemasInternals.h>
+
+enum  xml_entry_type {
+        ENTRY_TYPE_NULL,
+        ENTRY_TYPE_BOOL,
+        ENTRY_TYPE_STRING,
+        ENTRY_TYPE_NUMBER,
+        ENTRY_TYPE_ARRAY,
+        ENTRY_TYPE_OBJECT,
+};
+
+/**
+ * Sibling grouping
+ *
+ * The child elements of a node are grouped by name: each group becomes one
+ * member of the JSON object, in the order the names were first seen, and
+ * a group with more than one value, or whose element the schema lets
+ * repeat, becomes an array in document order.
+ *
+ * Names are interned in a dictionary, so a group is identified by the
+ * address of its name and comparing or hashing a name is O(1), whatever
+ * its length.
+ *
+ * Most elements have a handful of children, so groups and values are kept
+ * in arrays inside the structure, and names are looked up by
+ * a linear scan. Only past SIBLINGS_INLINE groups or values do the arrays
+ * move to the heap, and past SIBLINGS_SCAN_MAX groups an open addressing
+ * index over the names is built. The structures live in the frames of the
+ * conversion stack, so heap arrays are kept for the next elements at the
+ * same depth rather than allocated for each one.
+ */
+#define SIBLINGS_INLINE 8
+#define SIBLINGS_SCAN_MAX 8
+
+struct sibling_value {
+        void *value;
+        enum xml_entry_type type;
+        size_t next;                    /* next value of the group, or 0 */
+};
+
+struct sibling_group {
+        const xmlChar *name;            /* interned */
+        size_t count;
+        int array;                      /* an array even with one value */
+        size_t first, last;             /* indices into values */
+};
+
+struct siblings {
+        struct sibling_group *groups;
+        size_t nr_groups, alloc_groups;
+
+        /* values[0] is unused, so that 0 can end a group's list */
+        struct sibling_value *values;
+        size_t nr_values, alloc_values;
+
+        size_t *index;                  /* group + 1, 0 for an empty slot */
+        size_t index_size;
+
+        struct sibling_group inline_groups[SIBLINGS_INLINE];
+        struct sibling_value inline_values[SIBLINGS_INLINE + 1];
+};
+
+static void siblings_init(struct siblings *sib)
+{
+        sib->groups = sib->inline_groups;
+        sib->nr_groups = 0;
+        sib->alloc_groups = SIBLINGS_INLINE;
+        sib->values = sib->inline_values;
+        sib->nr_values = 1;
+        sib->alloc_values = SIBLINGS_INLINE + 1;
+        sib->index = NULL;
+        sib->index_size = 0;
+}
+
+/* Grow an array that starts out inside the structure */
+static void *siblings_grow(void *array, void *inline_array, size_t *alloc,
+                           size_t size)
+{
+        size_t nr = *alloc;
+        void *p;
+
+        *alloc = alloc_nr(nr);
+        if (array == inline_array) {
+                p = xmalloc(st_mult(*alloc, size));
+                memcpy(p, array, nr * size);
+        } else {
+                p = xrealloc(array, st_mult(*alloc, size));
+        }
+
+        return p;
+}
+
+static size_t name_hash(const xmlChar *name)
+{
+        uint64_t h = (uintptr_t)name;
+
+        /* Fibonacci hashing, the low bits of an address carry little */
+        return (h * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static size_t *siblings_index_slot(struct siblings *sib, const xmlChar *name)
+{
+        size_t mask = sib->index_size - 1;
+        size_t i = name_hash(name) & mask;
+
+        while (sib->index[i]) {
+                if (sib->groups[sib->index[i] - 1].name == name)
+                        break;
+                i = (i + 1) & mask;
+        }
+
+        return &sib->index[i];
+}
+
+static void siblings_reindex(struct siblings *sib)
+{
+        size_t i;
+
+        free(sib->index);
+        sib->index_size = 64;
+        while (sib->index_size < sib->nr_groups * 2)
+                sib->index_size *= 2;
+        sib->index = xcalloc(sib->index_size, sizeof(size_t));
+
+        for (i = 0; i < sib->nr_groups; i++)
+                *siblings_index_slot(sib, sib->groups[i].name) = i + 1;
+}
+
+static struct sibling_group *siblings_group(struct siblings *sib,
+                                            const xmlChar *name)
+{
+        struct sibling_group *g;
+        size_t *slot = NULL;
+        size_t i;
+
+        if (sib->index == NULL) {
+                for (i = 0; i < sib->nr_groups; i++) {
+                        if (sib->groups[i].name == name)
+                                return &sib->groups[i];
+                }
+        } else {
+                slot = siblings_index_slot(sib, name);
+                if (*slot)
+                        return &sib->groups[*slot - 1];
+        }
+
+        if (sib->nr_groups == sib->alloc_groups)
+                sib->groups = siblings_grow(sib->groups, sib->inline_groups,
+                                            &sib->alloc_groups,
+                                            sizeof(struct sibling_group));
+
+        g = &sib->groups[sib->nr_groups++];
+        g->name = name;
+        g->count = 0;
+        g->array = 0;
+        g->first = g->last = 0;
+
+        if (sib->index && sib->nr_groups * 2 <= sib->index_size)
+                *slot = sib->nr_groups;
+        else if (sib->index || sib->nr_groups > SIBLINGS_SCAN_MAX)
+                siblings_reindex(sib);
+
+        return g;
+}
+
+static void siblings_add(struct siblings *sib, const xmlChar *name,
+                         void *value, enum xml_entry_type type, int array)
+{
+        struct sibling_group *g = siblings_group(sib, name);
+        struct sibling_value *v;
+        size_t i;
+
+        if (sib->nr_values == sib->alloc_values)
+                sib->values = siblings_grow(sib->values, sib->inline_values,
+                                            &sib->alloc_values,
+                                            sizeof(struct sibling_value));
+
+        i = sib->nr_values++;
+        v = &sib->values[i];
+        v->value = value;
+        v->type = type;
+        v->next = 0;
+
+        if (g->count++)
+                sib->values[g->last].next = i;
+        else
+                g->first = i;
+        g->last = i;
+        g->array |= array;
+}
+
+/* A text value as a JSON object, which takes over `str` */
+static JsonObject *text_to_json_obj(char *str, enum xml_entry_type type)
+{
+        int b;
+
+        switch (type) {
+        case ENTRY_TYPE_NUMBER:
+                return json_num_obj_take(str);
+        case ENTRY_TYPE_BOOL:
+                b = (str[0] == 't');
+                json_str_free(str);
+                return json_bool_obj(b);
+        default:
+                return json_string_obj_take(str);
+        }
+}
+
+static JsonObject *sibling_value_to_json_obj(struct sibling_value *v)
+{
+        switch (v->type) {
+        case ENTRY_TYPE_NULL:
+                return json_null_obj();
+        case ENTRY_TYPE_STRING:
+        case ENTRY_TYPE_NUMBER:
+        case ENTRY_TYPE_BOOL:
+                return text_to_json_obj(v->value, v->type);
+        default:
+                return v->value;
+        }
+}
+
+static JsonObject *siblings_to_json_obj(struct siblings *sib)
+{
+        JsonObject *jobj;
+        size_t i, j;
+
+        jobj = json_new();
+
+        for (i = 0; i < sib->nr_groups; i++) {
+                struct sibling_group *g = &sib->groups[i];
+                JsonObject *val;
+
+                if (g->count > 1 || g->array) {
+                        val = json_array_obj();
+                        for (j = g->first; j; j = sib->values[j].next)
+                                json_append_to_array(val,
+                                        sibling_value_to_json_obj(&sib->values[j]));
+                } else {
+                        val = sibling_value_to_json_obj(&sib->values[g->first]);
+                }
+
+                json_append_member(jobj, (const char *)g->name, val);
+        }
+
+        return jobj;
+}
+
+/* Forget the values of `sib`, keeping the arrays for the next element.
+ * With `free_values`, the values not handed over to a JSON object are
+ * freed too.
+ */
+static void siblings_clear(struct siblings *sib, int free_values)
+{
+        size_t i;
+
+        for (i = 1; free_values && i < sib->nr_values; i++) {
+                struct sibling_value *v = &sib->values[i];
+
+                if (v->type == ENTRY_TYPE_OBJECT ||
+                    v->type == ENTRY_TYPE_ARRAY)
+                        json_free(v->value);
+                else
+                        json_str_free(v->value);
+        }
+
+        sib->nr_groups = 0;
+        sib->nr_values = 1;
+        free(sib->index);
+        sib->index = NULL;
+        sib->index_size = 0;
+}
+
+static void siblings_release(struct siblings *sib)
+{
+        if (sib->groups != sib->inline_groups)
+                free(sib->groups);
+        if (sib->values != sib->inline_values)
+                free(sib->values);
+        free(sib->index);
+}
+
+/**
+ * XML parsing
+ *
+ * The tree is walked without recursion: every element whose children are
+ * being converted has a frame on an explicit stack, so nesting is bounded
+ * by memory rather than by the C stack. Frames hold the siblings of the
+ * element's children, which point into the frame itself, so each frame is
+ * allocated once and kept, at the same address, for the next documents.
+ */
+struct convert_frame {
+        xmlNodePtr element;             /* NULL for the document */
+        xmlNodePtr next;                /* next child to convert */
+        const struct xsd_element *decl; /* with typed output, or NULL */
+        const xmlChar *child_name;      /* last child looked up... */
+        const struct xsd_element *child_decl;   /* ...and its declaration */
+        int has_children;
+        char *text;                     /* the text, which wins over elements */
+        enum xml_entry_type text_type;
+        struct siblings sib;
+
+        /* Direct emission: the group and the value written next */
+        unsigned int members;
+        size_t group, value;
+};
+
+struct convert_stack {
+        struct convert_frame **frames;
+        size_t depth;                   /* frames in use */
+        size_t nr_frames, alloc;        /* frames allocated */
+
+        /* Direct emission: normalised text and attributes */
+        char *text, *attr_text;
+        size_t alloc_text, alloc_attr_text;
+        xmlAttrPtr *attrs;
+        size_t nr_attrs, alloc_attrs;
+
+        cstring attr_key;               /* "@name" of the tree's attributes */
+};
+
+/* Settings of one document's conversion */
+struct convert_ctx {
+        xmlDictPtr dict;                /* NULL if names are interned */
+        enum ws_mode ws;
+        int infer_types;                /* numbers and booleans from text */
+        const struct xsd_table *table;  /* NULL unless the schema is used */
+        struct json_tape *tape;         /* emit to, instead of a writer */
+        int xsd_types;                  /* values typed by the schema */
+        int xsd_arrays;                 /* arrays shaped by the schema */
+        struct convert_stack *stack;
+};
+
+static void convert_stack_free(struct convert_stack *stack)
+{
+        size_t i;
+
+        if (stack == NULL)
+                return;
+
+        for (i = 0; i < stack->nr_frames; i++) {
+                siblings_release(&stack->frames[i]->sib);
+                free(stack->frames[i]);
+        }
+        free(stack->frames);
+        free(stack->text);
+        free(stack->attr_text);
+        free(stack->attrs);
+        cstring_release(&stack->attr_key);
+        free(stack);
+}
+
+static struct convert_frame *convert_push(struct convert_stack *stack,
+                                          xmlNodePtr element,
+                                          xmlNodePtr children)
+{
+        struct convert_frame *f;
+
+        if (stack->depth == stack->nr_frames) {
+                ALLOC_GROW(stack->frames, stack->nr_frames + 1, stack->alloc);
+                f = xmalloc(sizeof(struct convert_frame));
+                siblings_init(&f->sib);
+                stack->frames[stack->nr_frames++] = f;
+        }
+
+        f = stack->frames[stack->depth++];
+        f->element = element;
+        f->next = children;
+        f->decl = NULL;
+        f->child_name = NULL;
+        f->has_children = (children != NULL);
+        f->text = NULL;
+        siblings_clear(&f->sib, 0);
+        f->members = 0;
+        f->group = f->value = 0;
+
+        return f;
+}
+
+/* The schema's declaration of `element`, a child of the element of frame
+ * `parent`, when the output is shaped by the schema. The children of an
+ * element the schema does not declare are not declared either. Siblings
+ * mostly repeat the name before them, which is then not looked up again.
+ */
+static const struct xsd_element *element_decl(const struct convert_ctx *ctx,
+                                              struct convert_frame *parent,
+                                              xmlNodePtr element)
+{
+        if (ctx->table == NULL)
+                return NULL;
+
+        if (parent->element && parent->decl == NULL)
+                return NULL;
+
+        if (parent->child_name == element->name)
+                return parent->child_decl;
+
+        parent->child_name = element->name;
+        parent->child_decl = xsd_table_lookup(ctx->table, parent->decl,
+                                              (const char *)element->name);
+
+        return parent->child_decl;
+}
+
+/* The type a text is converted to: the type its element is declared with
+ * in the schema, or a string unless types are inferred. Values of schema
+ * types are rewritten as JSON has them, `str` has room for that and `len`
+ * is updated.
+ */
+static enum xml_entry_type text_type(const struct convert_ctx *ctx,
+                                     const struct xsd_element *decl,
+                                     char *str, size_t *len)
+{
+        enum scalar_type type;
+
+        if (decl && ctx->xsd_types) {
+                type = xsd_value_to_json(xsd_table_value_type(ctx->table,
+                                                              decl),
+                                         str, len);
+                str[*len] = '\0';
+        } else if (ctx->infer_types) {
+                type = scalar_classify(str, *len);
+        } else {
+                return ENTRY_TYPE_STRING;
+        }
+
+        switch (type) {
+        case SCALAR_NUMBER:
+                return ENTRY_TYPE_NUMBER;
+        case SCALAR_BOOL:
+                return ENTRY_TYPE_BOOL;
+        default:
+                return ENTRY_TYPE_STRING;
+        }
+}
+
+/* Returns the text of `node` normalised according to the white space mode,
+ * in a single allocation read straight from the node's content, or NULL
+ * if the text is only white space. `type` is set to the text's type, for
+ * the element declared by `decl` if not NULL.
+ */
+static char *parse_xml_text_node(const struct convert_ctx *ctx,
+                                 xmlNodePtr node,
+                                 const struct xsd_element *decl,
+                                 enum xml_entry_type *type)
+{
+        const char *content = (const char *)node->content;
+        size_t len;
+        char *str;
+
+        if (content == NULL || (len = strlen(content)) == 0)
+                return NULL;
+
+        /* Typed values may grow by a byte, or become "false" */
+        str = json_str_alloc(len < 4 ? 6 : len + 2);
+        len = ws_normalize(str, content, len, ctx->ws);
+        if (len == 0) {
+                json_str_free(str);
+                return NULL;
+        }
+        str[len] = '\0';
+        *type = text_type(ctx, decl, str, &len);
+
+        return str;
+}
+
+/* The first text among `node` and its siblings, or NULL */
+static char *parse_xml_text(const struct convert_ctx *ctx, xmlNodePtr node,
+                            enum xml_entry_type *type)
+{
+        char *str;
+
+        for (; node; node = node->next) {
+                if (node->type != XML_TEXT_NODE)
+                        continue;
+                if ((str = parse_xml_text_node(ctx, node, NULL, type)))
+                        return str;
+        }
+
+        return NULL;
+}
+
+static void *parse_xml_element_attributes(const struct convert_ctx *ctx,
+                                          xmlAttrPtr attr,
+                                          void *attrobj,
+                                          enum xml_entry_type *type)
+
+{
+        if (attr == NULL) {
+                *type = ENTRY_TYPE_NULL;
+                return NULL;
+        }
+
+        if (attrobj == NULL)
+                attrobj = json_new();
+
+        while (attr != NULL) {
+                cstring *key = &ctx->stack->attr_key;
+                enum xml_entry_type vtype;
+                char *val;
+
+                /* Prepend '@' to the attribute name, json_prepend_member()
+                 * copies the key so the buffer is reused.
+                 */
+                cstring_setlen(key, 0);
+                cstring_addch(key, '@');
+                cstring_addstr(key, (const char *)attr->name);
+
+                val = parse_xml_text(ctx, attr->children, &vtype);
+
+                if (val) {
+                        json_prepend_member(attrobj, key->buf,
+                                            text_to_json_obj(val, vtype));
+                } else {
+                        fprintf(stderr, "attributes: non string type entry!\n");
+                }
+
+                attr = attr->next;
+        }
+
+        *type = ENTRY_TYPE_OBJECT;
+        return attrobj;
+}
+
+/* The name of an element as a dictionary entry */
+static const xmlChar *element_name(const struct convert_ctx *ctx,
+                                   xmlNodePtr node)
+{
+        if (ctx->dict == NULL)
+                return node->name;
+
+        return xmlDictLookup(ctx->dict, node->name, -1);
+}
+
+/* The value of a frame whose children have all been seen: its text, the
+ * object of its child elements, or NULL if it has no children.
+ */
+static void *frame_value(struct convert_frame *f, enum xml_entry_type *type)
+{
+        JsonObject *jobj;
+
+        if (f->text) {
+                *type = f->text_type;
+                return f->text;
+        }
+
+        if (!f->has_children) {
+                *type = ENTRY_TYPE_NULL;
+                return NULL;
+        }
+
+        *type = ENTRY_TYPE_OBJECT;
+        jobj = siblings_to_json_obj(&f->sib);
+        siblings_clear(&f->sib, 0);
+
+        return jobj;
+}
+
+/* Combine the value of an element's children with its attributes */
+static void *element_value(const struct convert_ctx *ctx, xmlNodePtr node,
+                           void *val, enum xml_entry_type *type)
+{
+        JsonObject *attrobj;
+        void *attrval;
+
+        if ((*type == ENTRY_TYPE_STRING || *type == ENTRY_TYPE_NUMBER ||
+             *type == ENTRY_TYPE_BOOL) && node->properties) {
+                attrobj = json_new();
+                json_prepend_member(attrobj, "#text",
+                                    text_to_json_obj(val, *type));
+                val = attrobj;
+        }
+
+        if (node->properties != NULL) {
+                /* We need to parse XML attributes */
+                attrval = parse_xml_element_attributes(ctx, node->properties,
+                                                       val, type);
+                if (val == NULL)
+                        val = attrval;
+        }
+
+        return val;
+}
+
+/* Convert the nodes starting at `node`, the children of the document, as
+ * if they were the children of an element.
+ */
+static void *parse_xml_nodes(const struct convert_ctx *ctx, xmlNodePtr node,
+                             enum xml_entry_type *type)
+{
+        struct convert_stack *stack = ctx->stack;
+        struct convert_frame *f;
+        xmlNodePtr n;
+        void *val;
+        int array;
+
+        f = convert_push(stack, NULL, node);
+
+        for (;;) {
+                if ((n = f->next)) {
+                        f->next = n->next;
+
+                        if (n->type == XML_ELEMENT_NODE) {
+                                const struct xsd_element *decl;
+
+                                decl = element_decl(ctx, f, n);
+                                f = convert_push(stack, n, n->children);
+                                f->decl = decl;
+                        } else if (n->type == XML_TEXT_NODE &&
+                                   (f->text = parse_xml_text_node(ctx, n,
+                                                        f->decl,
+                                                        &f->text_type))) {
+                                /* Text is the element's value, drop its
+                                 * children and skip the rest.
+                                 */
+                                siblings_clear(&f->sib, 1);
+                                f->next = NULL;
+                        }
+                        continue;
+                }
+
+                val = frame_value(f, type);
+                if (--stack->depth == 0)
+                        return val;
+
+                n = f->element;
+                array = ctx->xsd_arrays && f->decl &&
+                        f->decl->array != SINGLE_ELEMENT;
+                f = stack->frames[stack->depth - 1];
+
+                val = element_value(ctx, n, val, type);
+                siblings_add(&f->sib, element_name(ctx, n), val, *type,
+                             array);
+        }
+}
+
+/* Build the JSON tree of `doc` and write it. The tree is left to the arena
+ * it was built in, which the caller resets.
+ */
+static void parse_xml_tree(xmlDocPtr doc, const struct convert_ctx *ctx,
+                           struct json_writer *w)
+{
+
+        enum xml_entry_type type;
+
+        if (doc == NULL)
+                return;
+
+        if ((doc->type == XML_DOCUMENT_NODE) && (doc->children != NULL)) {
+                void *data;
+
+                data = parse_xml_nodes(ctx, doc->children, &type);
+
+                json_write(w, (JsonObject *)data);
+                json_writer_addch(w, '\n');
+        }
+}
+
+/**
+ * Direct emission
+ *
+ * The JSON is written while the DOM is walked, without building a
+ * JsonObject tree. The children of an element are first grouped by name
+ * in its frame's siblings, with the nodes as values, and then written
+ * group by group, each group as an array if it has to be one. The frames,
+ * their sibling arrays and the text buffers are all the memory used, and
+ * they are kept for the next documents.
+ *
+ * The values go to the writer as JSON text or, with a tape, to the tape.
+ * Names of elements and attributes cannot hold anything JSON would need
+ * escaped, so keys are written as they are.
+ */
+
+/* Normalise the text of `node` into `*buf`, growing it as needed. Returns
+ * the length of the text, 0 if it is only white space, and sets `type` as
+ * parse_xml_text_node() does.
+ */
+static size_t emit_normalize(const struct convert_ctx *ctx, xmlNodePtr node,
+                             const struct xsd_element *decl,
+                             char **buf, size_t *alloc,
+                             enum xml_entry_type *type)
+{
+        const char *content = (const char *)node->content;
+        size_t len;
+
+        if (content == NULL || (len = strlen(content)) == 0)
+                return 0;
+
+        /* Typed values may grow by a byte, or become "false" */
+        ALLOC_GROW(*buf, len + 6, *alloc);
+        len = ws_normalize(*buf, content, len, ctx->ws);
+        if (len)
+                *type = text_type(ctx, decl, *buf, &len);
+
+        return len;
+}
+
+static void emit_text(const struct convert_ctx *ctx, struct json_writer *w,
+                      const char *str, size_t len, enum xml_entry_type type)
+{
+        if (ctx->tape) {
+                if (type == ENTRY_TYPE_STRING)
+                        json_tape_string(ctx->tape, str, len);
+                else if (type == ENTRY_TYPE_NUMBER)
+                        json_tape_number(ctx->tape, str, len);
+                else
+                        json_tape_bool(ctx->tape, str[0] == 't');
+        } else if (type == ENTRY_TYPE_STRING) {
+                json_writer_add_string(w, str, len);
+        } else {
+                json_writer_add(w, str, len);
+        }
+}
+
+static void emit_key(const struct convert_ctx *ctx, struct json_writer *w,
+                     const char *prefix, const xmlChar *name)
+{
+        size_t len = strlen((const char *)name);
+
+        if (ctx->tape) {
+                json_tape_key(ctx->tape, prefix, (const char *)name, len);
+                return;
+        }
+
+        json_writer_addch(w, '"');
+        if (prefix)
+                json_writer_add(w, prefix, strlen(prefix));
+        json_writer_add(w, (const char *)name, len);
+        json_writer_add(w, "\":", 2);
+}
+
+/* Objects and arrays, `tag` is their first or last character */
+static void emit_open(const struct convert_ctx *ctx, struct json_writer *w,
+                      int tag)
+{
+        if (ctx->tape)
+                json_tape_open(ctx->tape, tag);
+        else
+                json_writer_addch(w, tag);
+}
+
+static void emit_close(const struct convert_ctx *ctx, struct json_writer *w,
+                       int tag)
+{
+        if (ctx->tape)
+                json_tape_close(ctx->tape);
+        else
+                json_writer_addch(w, tag);
+}
+
+/* Separate two members or elements, the tape needs no separators */
+static void emit_comma(const struct convert_ctx *ctx, struct json_writer *w)
+{
+        if (ctx->tape == NULL)
+                json_writer_addch(w, ',');
+}
+
+static void emit_null(const struct convert_ctx *ctx, struct json_writer *w)
+{
+        if (ctx->tape)
+                json_tape_null(ctx->tape);
+        else
+                json_writer_add(w, "null", 4);
+}
+
+/* Write the attributes of `node` as members of an open object, in the
+ * order the tree conversion prepends them in. Returns how many were
+ * written.
+ */
+static unsigned int emit_attributes(const struct convert_ctx *ctx,
+                                    xmlNodePtr node, struct json_writer *w)
+{
+        struct convert_stack *stack = ctx->stack;
+        unsigned int members = 0;
+        xmlAttrPtr attr;
+        size_t i;
+
+        stack->nr_attrs = 0;
+        for (attr = node->properties; attr; attr = attr->next) {
+                ALLOC_GROW(stack->attrs, stack->nr_attrs + 1,
+                           stack->alloc_attrs);
+                stack->attrs[stack->nr_attrs++] = attr;
+        }
+
+        for (i = stack->nr_attrs; i > 0; i--) {
+                enum xml_entry_type type = ENTRY_TYPE_STRING;
+                xmlNodePtr n;
+                size_t len = 0;
+
+                attr = stack->attrs[i - 1];
+                for (n = attr->children; n && len == 0; n = n->next) {
+                        if (n->type == XML_TEXT_NODE)
+                                len = emit_normalize(ctx, n, NULL,
+                                                     &stack->attr_text,
+                                                     &stack->alloc_attr_text,
+                                                     &type);
+                }
+
+                if (len == 0) {
+                        fprintf(stderr, "attributes: non string type entry!\n");
+                        continue;
+                }
+
+                if (members++)
+                        emit_comma(ctx, w);
+                emit_key(ctx, w, "@", attr->name);
+                emit_text(ctx, w, stack->attr_text, len, type);
+        }
+
+        return members;
+}
+
+/* Group the child elements of frame `f` by name. Returns the length of
+ * the text that is the element's value instead, left in the stack's text
+ * buffer, or 0 if there is none.
+ */
+static size_t emit_group_children(const struct convert_ctx *ctx,
+                                  struct convert_frame *f,
+                                  enum xml_entry_type *type)
+{
+        struct convert_stack *stack = ctx->stack;
+        xmlNodePtr n;
+        size_t len;
+
+        for (n = f->next; n; n = n->next) {
+                if (n->type == XML_ELEMENT_NODE) {
+                        const struct xsd_element *decl;
+
+                        decl = element_decl(ctx, f, n);
+                        siblings_add(&f->sib, element_name(ctx, n), n,
+                                     ENTRY_TYPE_NULL,
+                                     ctx->xsd_arrays && decl &&
+                                     decl->array != SINGLE_ELEMENT);
+                } else if (n->type == XML_TEXT_NODE &&
+                           (len = emit_normalize(ctx, n, f->decl,
+                                                 &stack->text,
+                                                 &stack->alloc_text,
+                                                 type))) {
+                        siblings_clear(&f->sib, 0);
+                        return len;
+                }
+        }
+
+        return 0;
+}
+
+/* Start writing the value of the element of `f`, the top frame. Returns
+ * 1 if an object was opened, whose child elements are to be written, and
+ * 0 if the whole value was written and the frame popped.
+ */
+static int emit_value(const struct convert_ctx *ctx, struct convert_frame *f,
+                      struct json_writer *w)
+{
+        static const xmlChar text_key[] = "#text";
+        xmlNodePtr node = f->element;
+        int attrs = node && node->properties;
+        enum xml_entry_type type;
+        size_t len;
+
+        len = emit_group_children(ctx, f, &type);
+        if (len) {
+                if (attrs) {
+                        emit_open(ctx, w, '{');
+                        if (emit_attributes(ctx, node, w))
+                                emit_comma(ctx, w);
+                        emit_key(ctx, w, NULL, text_key);
+                }
+                emit_text(ctx, w, ctx->stack->text, len, type);
+                if (attrs)
+                        emit_close(ctx, w, '}');
+        } else if (f->has_children || attrs) {
+                emit_open(ctx, w, '{');
+                if (attrs)
+                        f->members = emit_attributes(ctx, node, w);
+                if (f->has_children)
+                        return 1;
+                emit_close(ctx, w, '}');
+        } else {
+                emit_null(ctx, w);
+        }
+
+        siblings_clear(&f->sib, 0);
+        ctx->stack->depth--;
+
+        return 0;
+}
+
+/* Write the nodes starting at `node`, the children of the document, as if
+ * they were the children of an element.
+ */
+static void emit_xml_nodes(const struct convert_ctx *ctx, xmlNodePtr node,
+                           struct json_writer *w)
+{
+        struct convert_stack *stack = ctx->stack;
+        struct convert_frame *f;
+
+        f = convert_push(stack, NULL, node);
+        if (!emit_value(ctx, f, w))
+                return;
+
+        for (;;) {
+                struct sibling_group *g;
+
+                if (f->group < f->sib.nr_groups) {
+                        const struct xsd_element *decl;
+                        struct sibling_value *v;
+                        struct convert_frame *child;
+                        xmlNodePtr n;
+
+                        g = &f->sib.groups[f->group];
+                        if (f->value == 0) {
+                                if (f->members++)
+                                        emit_comma(ctx, w);
+                                emit_key(ctx, w, NULL, g->name);
+                                if (g->count > 1 || g->array)
+                                        emit_open(ctx, w, '[');
+                                f->value = g->first;
+                        } else {
+                                emit_comma(ctx, w);
+                        }
+
+                        v = &f->sib.values[f->value];
+                        f->value = v->next;
+                        n = v->value;
+
+                        decl = element_decl(ctx, f, n);
+                        child = convert_push(stack, n, n->children);
+                        child->decl = decl;
+                        if (emit_value(ctx, child, w)) {
+                                f = child;
+                                continue;
+                        }
+                } else {
+                        emit_close(ctx, w, '}');
+                        siblings_clear(&f->sib, 0);
+                        if (--stack->depth == 0)
+                                return;
+                        f = stack->frames[stack->depth - 1];
+                }
+
+                /* A value of the current group of `f` was written */
+                if (f->value == 0) {
+                        g = &f->sib.groups[f->group++];
+                        if (g->count > 1 || g->array)
+                                emit_close(ctx, w, ']');
+                }
+        }
+}
+
+static void emit_xml_tree(xmlDocPtr doc, const struct convert_ctx *ctx,
+                          struct json_writer *w)
+{
+        if (doc == NULL)
+                return;
+
+        if ((doc->type == XML_DOCUMENT_NODE) && (doc->children != NULL)) {
+                emit_xml_nodes(ctx, doc->children, w);
+                if (ctx->tape) {
+                        json_tape_write(ctx->tape, w);
+                        json_tape_reset(ctx->tape);
+                }
+                json_writer_addch(w, '\n');
+        }
+}
+
+static xmlDocPtr read_xml_file(struct converter *conv, const char *xmlfile)
+{
+        int fd;
+        struct stat sbinfo;
+        xmlDocPtr doc = NULL;
+        char *base;
+
+        /* Pipes can't be mapped, push them to the parser as they come */
+        if (xml_input_is_stdin(xmlfile))
+                return xml_read_fd(conv->pctxt, STDIN_FILENO, xmlfile,
+                                   conv->xml_options);
+
+        /* mmap the file() */
+        if ((fd = open(xmlfile, O_RDONLY)) < 0) {
+                perror("open: ");
+                return NULL;
+        }
+
+        if (fstat(fd, &sbinfo) < 0) {
+                perror("stat: ");
+                close(fd);
+                return NULL;
+        }
+
+        if (!S_ISREG(sbinfo.st_mode)) {
+                doc = xml_read_fd(conv->pctxt, fd, xmlfile,
+                                  conv->xml_options);
+                close(fd);
+                return doc;
+        }
+
+        if ((size_t)sbinfo.st_size > XML_INPUT_LARGE_FILE) {
+                doc = xml_read_mapped(conv->pctxt, fd, sbinfo.st_size,
+                                      xmlfile, conv->xml_options);
+                close(fd);
+                return doc;
+        }
+
+        base = mmap(NULL, sbinfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base == (void *) MAP_FAILED){
+                close(fd);
+                perror("mmap: ");
+                return NULL;
+        }
+        madvise(base, sbinfo.st_size, MADV_SEQUENTIAL);
+
+        /* Read into an xmlDocPtr, reusing the parser context */
+        doc = xml_read_memory(conv->pctxt, base, sbinfo.st_size, xmlfile,
+                              conv->xml_options);
+
+        munmap((char *)base, sbinfo.st_size);
+        close(fd);
+
+        return doc;
+}
+
+/* Validation happens while the document is being parsed: the schema's
+ * validation context is plugged in front of the parser's SAX handlers,
+ * which build the tree as usual.
+ */
+static int parser_locator(void *data, const char **file, unsigned long *line)
+{
+        xmlParserCtxtPtr ctxt = data;
+
+        if (ctxt->input == NULL)
+                return -1;
+
+        if (file)
+                *file = ctxt->input->filename;
+        if (line)
+                *line = ctxt->input->line;
+
+        return 0;
+}
+
+static xmlSchemaSAXPlugPtr validate_begin(struct converter *conv)
+{
+        if (conv->vctxt == NULL)
+                return NULL;
+
+        xmlSchemaValidateSetLocator(conv->vctxt, parser_locator, conv->pctxt);
+
+        return xmlSchemaSAXPlug(conv->vctxt, &conv->pctxt->sax,
+                                &conv->pctxt->userData);
+}
+
+/* Whether the document parsed with `plug` in place validates. Those that
+ * are not well formed are failures of their own, reported by the parser.
+ */
+static int validate_end(struct converter *conv, xmlSchemaSAXPlugPtr plug)
+{
+        if (conv->vctxt == NULL)
+                return 0;
+
+        /* Without the plug nothing was validated */
+        if (plug == NULL)
+                return CONVERT_INVALID;
+
+        xmlSchemaSAXUnplug(plug);
+
+        return xmlSchemaIsValid(conv->vctxt) ? 0 : CONVERT_INVALID;
+}
+
+/* Hand a validation error to the converter's own handler, if it has one */
+static void validation_error(void *data, convert_error_ptr error)
+{
+        struct converter *conv = data;
+
+        if (conv->verror)
+                conv->verror(conv->verror_data, error);
+}
+
+static int converter_new_vctxt(struct converter *conv)
+{
+        conv->vctxt = xmlSchemaNewValidCtxt(conv->schema);
+        if (conv->vctxt == NULL)
+                return -1;
+
+        xmlSchemaSetValidStructuredErrors(conv->vctxt, validation_error, conv);
+        return 0;
+}
+
+/* Convert a freshly parsed document, then free it. `valid` is what
+ * validate_end() returned for it.
+ */
+static int convert_parsed(struct converter *conv, xmlDocPtr doc, int valid,
+                          struct json_writer *w)
+{
+        if (doc == NULL)
+                return -1;
+
+        converter_convert_doc(conv, doc, w);
+
+        xmlFreeDoc(doc);
+
+        return valid;
+}
+
+/*
+ * Public Functions
+ */
+
+int converter_backend_parse(const char *name, enum convert_backend *backend)
+{
+        if (strcmp(name, "emit") == 0)
+                *backend = BACKEND_EMIT;
+        else if (strcmp(name, "tree") == 0)
+                *backend = BACKEND_TREE;
+        else if (strcmp(name, "tape") == 0)
+                *backend = BACKEND_TAPE;
+        else
+                return -1;
+
+        return 0;
+}
+
+int converter_init(struct converter *conv, const char *xsdfile,
+                   const char *tablefile, int xml_options)
+{
+        memset(conv, 0, sizeof(struct converter));
+
+        conv->xml_options = xml_options;
+        conv->pctxt = xmlNewParserCtxt();
+        if (conv->pctxt == NULL)
+                return -1;
+
+        if (xsdfile == NULL && tablefile == NULL)
+                return 0;
+
+        conv->owns_schema = 1;
+
+        if (tablefile) {
+                conv->table = xcalloc(1, sizeof(struct xsd_table));
+                if (xsd_table_load(conv->table, tablefile) < 0) {
+                        fprintf(stderr, "%s: %s\n", tablefile,
+                                strerror(errno));
+                        converter_release(conv);
+                        return -1;
+                }
+        }
+
+        if (xsdfile == NULL)
+                return 0;
+
+        /* Parse the schema once, for all the documents */
+        conv->sctxt = xmlSchemaNewParserCtxt(xsdfile);
+        xmlSchemaSetParserErrors(conv->sctxt,
+                                 (xmlSchemaValidityErrorFunc)fprintf,
+                                 (xmlSchemaValidityWarningFunc)fprintf,
+                                 stderr);
+        conv->schema = xmlSchemaParse(conv->sctxt);
+        if (conv->schema == NULL) {
+                converter_release(conv);
+                return -1;
+        }
+
+        if (conv->table == NULL) {
+                struct xsd_model model;
+
+                memset(&model, 0, sizeof(struct xsd_model));
+                walkXsdSchema(&model, conv->schema->doc->children);
+
+                conv->table = xcalloc(1, sizeof(struct xsd_table));
+                xsd_table_build(conv->table, &model);
+                xsdschemafree(&model);
+        }
+
+        if (converter_new_vctxt(conv) < 0) {
+                converter_release(conv);
+                return -1;
+        }
+
+        return 0;
+}
+
+int converter_clone(struct converter *conv, const struct converter *src)
+{
+        memset(conv, 0, sizeof(struct converter));
+
+        conv->xml_options = src->xml_options;
+        conv->stream = src->stream;
+        conv->backend = src->backend;
+        conv->ws_mode = src->ws_mode;
+        conv->infer_types = src->infer_types;
+        conv->xsd_types = src->xsd_types;
+        conv->xsd_arrays = src->xsd_arrays;
+        conv->verror = src->verror;
+        conv->verror_data = src->verror_data;
+        conv->pctxt = xmlNewParserCtxt();
+        if (conv->pctxt == NULL)
+                return -1;
+
+        conv->schema = src->schema;
+        conv->table = src->table;
+        if (conv->schema && converter_new_vctxt(conv) < 0) {
+                converter_release(conv);
+                return -1;
+        }
+
+        return 0;
+}
+
+void converter_release(struct converter *conv)
+{
+        if (conv->vctxt)
+                xmlSchemaFreeValidCtxt(conv->vctxt);
+        if (conv->owns_schema) {
+                if (conv->table) {
+                        xsd_table_release(conv->table);
+                        free(conv->table);
+                }
+                if (conv->schema)
+                        xmlSchemaFree(conv->schema);
+        }
+        if (conv->sctxt)
+                xmlSchemaFreeParserCtxt(conv->sctxt);
+        if (conv->pctxt)
+                xmlFreeParserCtxt(conv->pctxt);
+        if (conv->dict)
+                xmlDictFree(conv->dict);
+        convert_stack_free(conv->stack);
+        json_arena_release(&conv->arena);
+        json_tape_release(&conv->tape);
+
+        memset(conv, 0, sizeof(struct converter));
+}
+
+void converter_convert_doc(struct converter *conv, xmlDocPtr doc,
+                           struct json_writer *w)
+{
+        struct convert_ctx ctx;
+
+        ctx.dict = NULL;
+        ctx.ws = conv->ws_mode;
+        ctx.infer_types = conv->infer_types;
+        ctx.xsd_types = conv->xsd_types;
+        ctx.xsd_arrays = conv->xsd_arrays;
+        ctx.table = (ctx.xsd_types || ctx.xsd_arrays) ? conv->table : NULL;
+        ctx.tape = conv->backend == BACKEND_TAPE ? &conv->tape : NULL;
+
+        if (conv->stack == NULL) {
+                conv->stack = xcalloc(1, sizeof(struct convert_stack));
+                cstring_init(&conv->stack->attr_key, 0);
+        }
+        ctx.stack = conv->stack;
+
+        /* Names are grouped by address, intern them if the parser didn't */
+        if (doc->dict == NULL) {
+                if (conv->dict == NULL)
+                        conv->dict = xmlDictCreate();
+                ctx.dict = conv->dict;
+        }
+
+        if (conv->backend == BACKEND_TREE) {
+                /* The tree lives in the converter's arena, which is
+                 * reset, not freed, for the next document.
+                 */
+                struct json_arena *prev = json_use_arena(&conv->arena);
+
+                parse_xml_tree(doc, &ctx, w);
+                json_use_arena(prev);
+                json_arena_reset(&conv->arena);
+        } else {
+                emit_xml_tree(doc, &ctx, w);
+        }
+}
+
+int converter_convert_file(struct converter *conv, const char *xmlfile,
+                           struct json_writer *w)
+{
+        xmlSchemaSAXPlugPtr plug;
+        xmlDocPtr doc;
+        int ret;
+
+        if (conv->stream) {
+                ret = xml_stream_convert(conv, xmlfile, w);
+                if (ret == 0 && conv->vctxt && !xmlSchemaIsValid(conv->vctxt))
+                        ret = CONVERT_INVALID;
+                return ret;
+        }
+
+        plug = validate_begin(conv);
+        doc = read_xml_file(conv, xmlfile);
+
+        return convert_parsed(conv, doc, validate_end(conv, plug), w);
+}
+
+int converter_convert_buffer(struct converter *conv, const char *buf,
+                             size_t len, const char *name,
+                             struct json_writer *w)
+{
+        xmlSchemaSAXPlugPtr plug;
+        xmlDocPtr doc;
+
+        plug = validate_begin(conv);
+        doc = xml_read_memory(conv->pctxt, buf, len, name, conv->xml_options);
+
+        return convert_parsed(conv, doc, validate_end(conv, plug), w);
+}
@@ -0,0 +1,136 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * converter - XML to JSON conversion state, reusable across documents.
+ */
+
+#ifndef XML2JSON_CONVERTER_H
+#define XML2JSON_CONVERTER_H
+
+#define LIBXML_SCHEMAS_ENABLED
+#include <libxml/parser.h>
+#include <libxml/xmlschemas.h>
+
+#include "json.h"
+#include "jsontape.h"
+#include "whitespace.h"
+#include "xsdtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct convert_stack;
+
+/* What structured error handlers get, const since libxml2 2.12 */
+#if LIBXML_VERSION >= 21200
+typedef const xmlError *convert_error_ptr;
+#else
+typedef xmlError *convert_error_ptr;
+#endif
+
+/* How a parsed document becomes JSON */
+enum convert_backend {
+        BACKEND_EMIT,                   /* written while the DOM is walked */
+        BACKEND_TREE,                   /* through a JsonObject tree */
+        BACKEND_TAPE,                   /* through a struct json_tape */
+};
+
+struct converter {
+        int xml_options;
+        int stream;                     /* use xml_stream_convert() */
+        enum convert_backend backend;   /* for documents not streamed */
+        enum ws_mode ws_mode;           /* white space in text */
+        int infer_types;                /* numbers and booleans from text */
+        int xsd_types;                  /* values typed by the schema */
+        int xsd_arrays;                 /* arrays shaped by the schema */
+
+        xmlParserCtxtPtr pctxt;         /* reused for every document */
+        xmlDictPtr dict;                /* names of documents without one */
+        struct convert_stack *stack;    /* frames of the tree walk */
+        struct json_arena arena;        /* JSON trees, with BACKEND_TREE */
+        struct json_tape tape;          /* with BACKEND_TAPE */
+
+        /* Only set when converting with an XSD. The schema and its element
+         * table are read-only once loaded, and shared by cloned converters.
+         * The table may be loaded without the schema, which is only needed
+         * to validate documents.
+         */
+        xmlSchemaParserCtxtPtr sctxt;
+        xmlSchemaPtr schema;
+        struct xsd_table *table;
+        int owns_schema;
+        xmlSchemaValidCtxtPtr vctxt;
+
+        /* Receives the errors of documents failing to validate, which are
+         * dropped while it is NULL. Copied by converter_clone().
+         */
+        xmlStructuredErrorFunc verror;
+        void *verror_data;
+};
+
+/* Returned by the conversion functions when the document was converted but
+ * fails to validate against the schema.
+ */
+#define CONVERT_INVALID 1
+
+/* converter_backend_parse():
+ * Set `backend` from its name: emit, tree or tape. Returns 0 on success, -1 for
+ * an unknown name.
+ */
+extern int converter_backend_parse(const char *name,
+                                   enum convert_backend *backend);
+
+/* converter_init():
+ * Initialise the converter. If `xsdfile` is not NULL, the schema is parsed
+ * once here and every document converted afterwards is validated against
+ * it. The schema's element table is loaded from `tablefile`, as written by
+ * xsd_table_write(), if given, and built from the schema otherwise.
+ * Returns 0 on success, -1 if the schema or table could not be loaded.
+ */
+extern int converter_init(struct converter *conv, const char *xsdfile,
+                          const char *tablefile, int xml_options);
+
+/* converter_clone():
+ * Initialise `conv` with the options and the schema of `src`, but with its
+ * own parser and validation contexts, so both can be used concurrently
+ * from different threads. `src` must outlive `conv`.
+ */
+extern int converter_clone(struct converter *conv,
+                           const struct converter *src);
+
+/* converter_release():
+ * Release all the memory held by the converter.
+ */
+extern void converter_release(struct converter *conv);
+
+/* converter_convert_file():
+ * Convert `xmlfile` and write the JSON, followed by a newline, to `w`.
+ * All the per document state is released before returning.
+ * Returns 0 on success, CONVERT_INVALID if the document was converted but
+ * fails to validate, and -1 on failure.
+ */
+extern int converter_convert_file(struct converter *conv, const char *xmlfile,
+                                  struct json_writer *w);
+
+/* converter_convert_buffer():
+ * Like converter_convert_file(), for a document of `len` bytes in memory.
+ * `name` is only used in messages. The buffer is not modified and may be
+ * released as soon as this returns.
+ */
+extern int converter_convert_buffer(struct converter *conv, const char *buf,
+                                    size_t len, const char *name,
+                                    struct json_writer *w);
+
+/* converter_convert_doc():
+ * Convert an already parsed document and write the JSON, followed by a
+ * newline, to `w`. The document is not validated.
+ */
+extern void converter_convert_doc(struct converter *conv, xmlDocPtr doc,
+                                  struct json_writer *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_CONVERTER_H */
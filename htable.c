@@ -68,6 +68,9 @@ static inline struct htable_entry **find_entry(const struct htable *ht,
         return e;
 }
 
+/* Entries with the same key are moved as one run, so they stay together
+ * and in order.
+ */
 static void rehash(struct htable *ht, unsigned int newsize)
 {
         unsigned int i, oldsize = ht->size;
@@ -77,9 +80,10 @@ static void rehash(struct htable *ht, unsigned int newsize)
         for (i = 0; i < oldsize; i++) {
                 struct htable_entry *e = oldtable[i];
                 while (e) {
-                        struct htable_entry *n = e->next;
+                        struct htable_entry *last = e->last;
+                        struct htable_entry *n = last->next;
                         unsigned int b = bucket(ht, e);
-                        e->next = ht->table[b];
+                        last->next = ht->table[b];
                         ht->table[b] = e;
                         e = n;
                 }
@@ -88,6 +92,30 @@ static void rehash(struct htable *ht, unsigned int newsize)
         free(oldtable);
 }
 
+/* Put `new`, which may be NULL, in place of `old` in the list of keys */
+static void iter_replace(struct htable *ht, struct htable_entry *old,
+                         struct htable_entry *new)
+{
+        struct htable_entry *prev = old->iter_prev, *next = old->iter_next;
+
+        if (new) {
+                new->iter_prev = prev;
+                new->iter_next = next;
+        }
+
+        if (prev)
+                prev->iter_next = new ? new : next;
+        else
+                ht->iter_head = new ? new : next;
+
+        if (next)
+                next->iter_prev = new ? new : prev;
+        else
+                ht->iter_tail = new ? new : prev;
+
+        old->iter_prev = old->iter_next = NULL;
+}
+
 /* Public functions */
 unsigned int bufhash(const void *buf, size_t len)
 {
@@ -111,7 +139,6 @@ void htable_init(struct htable *ht, htable_cmp_fn cmp_fn,
 
         ht->cmpfn = cmp_fn ? cmp_fn : default_cmp_fn;
         ht->cmpfndata = cmpfndata;
-        ht->iter_head = ht->iter_tail = UINT_MAX;
 
         /* calculate initial size */
         size = size * 100 / HTABLE_RESIZE_THRESHOLD;
@@ -146,50 +173,45 @@ void *htable_get(const struct htable *ht, const void *key, const void *keydata)
 
 const void *htable_get_next(const struct htable *ht, const void *entry)
 {
-        const struct htable_entry *e = ((const struct htable_entry *) entry)->next;
-        for (; e; e = e->next)
-                if (entries_equal(ht, entry, e, NULL))
-                        return e;
+        const struct htable_entry *e = entry;
+
+        /* Entries with the same key follow each other */
+        if (e->next && entries_equal(ht, e, e->next, NULL))
+                return e->next;
 
         return NULL;
 }
 
 void htable_put(struct htable *ht, void *entry)
 {
-        unsigned int b = bucket(ht, entry);
-        int collision = 0;
-
-        collision = ht->table[b] ? 1 : 0;
-
-        if (collision) {
-                ((struct htable_entry *) entry)->iter_prev =
-                        ((struct htable_entry *) ht->table[b])->iter_prev;
-                ((struct htable_entry *) entry)->iter_next =
-                        ((struct htable_entry *) ht->table[b])->iter_next;
-                ((struct htable_entry *) entry)->count =
-                        ((struct htable_entry *) ht->table[b])->count;
-        }
-
-        ((struct htable_entry *) entry)->next = ht->table[b];
-        ht->table[b] = entry;
-
-        ((struct htable_entry *) entry)->count += 1;
-
-        if (ht->iter_head == UINT_MAX) { /* First entry */
-                ((struct htable_entry *) entry)->iter_prev = UINT_MAX;
-                ((struct htable_entry *) entry)->iter_next = UINT_MAX;
-                ht->iter_head = b;
-                ht->iter_tail = b;
+        struct htable_entry *e = entry;
+        struct htable_entry *first = *find_entry(ht, e, NULL);
+
+        if (first) {
+                /* A duplicate goes after the last entry with its key */
+                e->next = first->last->next;
+                first->last->next = e;
+                first->last = e;
+                first->count++;
         } else {
-                if (!collision) {
-                        ((struct htable_entry *) ht->table[ht->iter_tail])->iter_next = b;
-                        ((struct htable_entry *) entry)->iter_prev = ht->iter_tail;
-                        ht->iter_tail = b;
-                }
+                unsigned int b = bucket(ht, e);
+
+                e->next = ht->table[b];
+                ht->table[b] = e;
+                e->count = 1;
+                e->last = e;
+
+                e->iter_prev = ht->iter_tail;
+                e->iter_next = NULL;
+                if (ht->iter_tail)
+                        ht->iter_tail->iter_next = e;
+                else
+                        ht->iter_head = e;
+                ht->iter_tail = e;
         }
 
         ht->count++;
-        if (ht->count < ht->shrink_mark)
+        if (ht->count > ht->grow_mark)
                 rehash(ht, ht->size << HTABLE_RESIZE_BITS);
 }
 
@@ -204,9 +226,18 @@ void *htable_remove(struct htable *ht, const void *key,
 
         old = *e;
         *e = old->next;
+
+        /* The next entry with the key, if any, becomes the first one */
+        if (old->count > 1) {
+                struct htable_entry *n = old->next;
+
+                n->count = old->count - 1;
+                n->last = old->last;
+                iter_replace(ht, old, n);
+        } else {
+                iter_replace(ht, old, NULL);
+        }
         old->next = NULL;
-        /* TODO: Update entry count */
-        /* TODO: Update the iter_prev and iter_next values */
 
         ht->count--;
         if (ht->count < ht->shrink_mark)
@@ -250,36 +281,21 @@ void *htable_iter_next(struct htable_iter *iter)
 void htable_iter_init_ordered(struct htable *ht, struct htable_iter *iter)
 {
         iter->ht = ht;
-        iter->pos = ht->iter_head;
-        iter->count = 0;
-        iter->next = NULL;
+        iter->pos = 0;
+        iter->next = ht->iter_head;
 }
 
 void *htable_iter_ordered_get(struct htable_iter *iter)
 {
-        struct htable_entry *current = iter->ht->table[iter->pos];
-
-        return current;
+        return iter->next;
 }
 
 void *htable_iter_next_ordered(struct htable_iter *iter)
 {
-        struct htable_entry *current = NULL;
-
-        iter->count += 1;
-
-        if (iter->pos == UINT_MAX)
-                return NULL;
-
-        if (iter->count > iter->ht->count)
-                return NULL;
-
-        current = iter->ht->table[iter->pos];
+        struct htable_entry *current = iter->next;
 
-        if (current) {
-                iter->pos = current->iter_next;
-                return current;
-        }
+        if (current)
+                iter->next = current->iter_next;
 
-        return NULL;
+        return current;
 }
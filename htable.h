@@ -15,8 +15,6 @@
 extern "C" {
 #endif
 
-#define ITER_IDX_END UINT_MAX
-
 unsigned int bufhash(const void *buf, size_t len);
 
 /* Comparison function */
@@ -26,12 +24,18 @@ typedef int (*htable_cmp_fn)(const void *data, const void *entry1,
 /* struct htable_entry represents an entry in the hash table
  * and should be the first member in the user data structure for
  * the entry.
+ *
+ * Entries with the same key follow each other in their bucket, in the
+ * order they were put. The first of them holds the count and the last
+ * one, and is linked into the list of keys, in the order the keys were
+ * first put.
  */
 struct htable_entry {
-        struct htable_entry *next; /* next element in case of collision */
+        struct htable_entry *next; /* next element in the bucket */
         unsigned int hash;
         unsigned int count;        /* count of members in this entry */
-        unsigned int iter_prev, iter_next;
+        struct htable_entry *last; /* last entry with this key */
+        struct htable_entry *iter_prev, *iter_next;
 };
 
 struct htable {
@@ -45,7 +49,7 @@ struct htable {
 
         unsigned int grow_mark;
         unsigned int shrink_mark;
-        unsigned int iter_head, iter_tail;
+        struct htable_entry *iter_head, *iter_tail;
 };
 
 extern void htable_init(struct htable *ht, htable_cmp_fn cmp_fn,
@@ -61,25 +65,28 @@ static inline void htable_entry_init(void *entry, unsigned int hash)
         e->hash = hash;
         e->next = NULL;
         e->count = 0;
-        e->iter_prev = 0;
-        e->iter_next = 0;
+        e->last = NULL;
+        e->iter_prev = NULL;
+        e->iter_next = NULL;
 }
 
 /* htable_get():
- *  get the entry for a given key, NULL otherwise.
+ *  get the entry for a given key, the first one put if there are
+ * duplicates, NULL otherwise.
  */
 extern void *htable_get(const struct htable *ht, const void *key,
                         const void *keydata);
 
 /* htable_get_next():
- *  get the 'next' entry in the hash table, when there are duplicate entries
- * becuase of collision, NULL if there are no duplicate entries. `entry` is
- * where the lookup should start from.
+ *  get the 'next' entry with the same key as `entry`, in the order they
+ * were put, NULL if there are no more. Runs in constant time.
  */
 extern const void *htable_get_next(const struct htable *ht, const void *entry);
 
 /* htable_put():
- *  adds a entry into the hash table. Allows duplicate entries.
+ *  adds a entry into the hash table. Allows duplicate entries, which are
+ * kept in the order they were put. The table grows as needed, so this
+ * runs in amortised constant time.
  */
 extern void htable_put(struct htable *ht, void *entry);
 
@@ -92,8 +99,8 @@ extern void *htable_replace(struct htable *ht, void *entry);
 
 /* htable_remove():
  *  remove an entry in the hash table matching a specified key. If the key
- * contains duplicate entries, only one will be removed. Returns the removed
- * entry or NULL if no entry exists.
+ * contains duplicate entries, only the first one put will be removed.
+ * Returns the removed entry or NULL if no entry exists.
  */
 extern void *htable_remove(struct htable *ht, const void *key,
                            const void *keydata);
@@ -102,13 +109,17 @@ extern void *htable_remove(struct htable *ht, const void *key,
 struct htable_iter {
         struct htable *ht;
         struct htable_entry *next;
-        unsigned int count;
         unsigned int pos;
 };
 
 extern void htable_iter_init(struct htable *ht, struct htable_iter *iter);
 extern void *htable_iter_next(struct htable_iter *iter);
 
+/* htable_iter_init_ordered():
+ *  iterate over the keys in the order they were first put: the ordered
+ * iterator returns the first entry of each key, htable_get_next() gives
+ * the others. Grouping n entries by key this way takes O(n).
+ */
 extern void htable_iter_init_ordered(struct htable *ht,
                                      struct htable_iter *iter);
 extern void *htable_iter_ordered_get(struct htable_iter *iter);
@@ -6,120 +6,222 @@
 #include "json.h"
 
 #include "cstring.h"
+#include "jsonescape.h"
+#include "numfmt.h"
 #include "util.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+
+struct json_arena_chunk {
+        struct json_arena_chunk *next;
+        size_t size;
+        char data[];
+};
+
+/* The arena objects are allocated from, per thread */
+static __thread struct json_arena *json_arena_in_use;
 
 
 /*
  * Private Functions
  */
-static void parse_json_object(JsonObject *object, cstring *str);
-
 static bool is_json_type_valid(unsigned int type)
 {
         return (type <= JSON_OBJECT);
 }
 
-static void parse_string_object(const char *s, cstring *str)
+static inline void writer_addstr(struct json_writer *w, const char *s)
 {
-        /* TODO: Make this function utf-8 aware */
-        cstring_addch(str, '"');
-        cstring_addstr(str, s);
-        cstring_addch(str, '"');
+        json_writer_add(w, s, strlen(s));
 }
 
-static void parse_num_object(double num, cstring *str)
+static void parse_string_object(const char *s, struct json_writer *w)
 {
-        char buf[64];
-
-        sprintf(buf, "%.16g", num);
-        /* TODO: Check if `buf` has a valid number */
-        cstring_addstr(str, buf);
+        json_writer_add_string(w, s, strlen(s));
 }
 
-static void parse_array_object(JsonObject *object, cstring *str)
+static void parse_num_object(double num, struct json_writer *w)
 {
-        JsonObject *element;
+        char buf[NUMFMT_MAX];
 
-        cstring_addch(str, '[');
-        json_foreach(element, object) {
-                parse_json_object(element, str);
-                if (element->next != NULL)
-                        cstring_addch(str, ',');
-        }
-        cstring_addch(str, ']');
+        json_writer_add(w, buf, numfmt_double(buf, num));
 }
 
-static void parse_object(JsonObject *object, cstring *str)
-{
-        JsonObject *member;
-
-        cstring_addch(str, '{');
-
-        json_foreach(member, object) {
-                parse_string_object(member->key, str);
-                cstring_addch(str, ':');
-                parse_json_object(member, str);
-                if (member->next != NULL)
-                        cstring_addch(str, ',');
-        }
-
-        cstring_addch(str, '}');
-}
-
-static void parse_json_object(JsonObject *object, cstring *str)
+static void parse_scalar_object(JsonObject *object, struct json_writer *w)
 {
         assert(is_json_type_valid(object->type));
 
         switch (object->type) {
         case JSON_NULL:
-                cstring_addstr(str, "null");
+                writer_addstr(w, "null");
                 break;
         case JSON_BOOL:
-                cstring_addstr(str, object->bool_ ? "true" : "false");
+                writer_addstr(w, object->bool_ ? "true" : "false");
                 break;
         case JSON_STRING:
-                parse_string_object(object->str_, str);
+                parse_string_object(object->str_, w);
                 break;
         case JSON_NUMBER:
-                parse_num_object(object->num_, str);
-                break;
-        case JSON_ARRAY:
-                parse_array_object(object, str);
-                break;
-        case JSON_OBJECT:
-                parse_object(object, str);
+                if (object->lexeme_)
+                        writer_addstr(w, object->lexeme_);
+                else
+                        parse_num_object(object->num_, w);
                 break;
         default:
                 assert(false);
         }
 }
 
+/* Objects and arrays are encoded without recursion: the walk goes down to
+ * the first child and back up through the parent links, so no stack is
+ * needed however deep the tree is.
+ */
+static void parse_json_object(JsonObject *object, struct json_writer *w)
+{
+        JsonObject *obj = object;
+
+        for (;;) {
+                if (obj != object && obj->parent->type == JSON_OBJECT) {
+                        parse_string_object(obj->key, w);
+                        json_writer_addch(w, ':');
+                }
+
+                if (obj->type == JSON_ARRAY || obj->type == JSON_OBJECT) {
+                        json_writer_addch(w, obj->type == JSON_ARRAY ?
+                                          '[' : '{');
+                        if (obj->children.head) {
+                                obj = obj->children.head;
+                                continue;
+                        }
+                        json_writer_addch(w, obj->type == JSON_ARRAY ?
+                                          ']' : '}');
+                } else {
+                        parse_scalar_object(obj, w);
+                }
+
+                /* Close the containers this was the last child of */
+                while (obj != object && obj->next == NULL) {
+                        obj = obj->parent;
+                        json_writer_addch(w, obj->type == JSON_ARRAY ?
+                                          ']' : '}');
+                }
+
+                if (obj == object)
+                        break;
+
+                json_writer_addch(w, ',');
+                obj = obj->next;
+        }
+}
+
+static int cstring_sink(void *data, const struct iovec *iov, int iovcnt)
+{
+        cstring *str = data;
+        int i;
+
+        for (i = 0; i < iovcnt; i++)
+                cstring_add(str, iov[i].iov_base, iov[i].iov_len);
+
+        return 0;
+}
+
+static int fd_sink(void *data, const struct iovec *iov, int iovcnt)
+{
+        struct json_writer *w = data;
+        struct iovec vec[2];
+        int i, cnt = 0;
+
+        for (i = 0; i < iovcnt && i < 2; i++) {
+                if (iov[i].iov_len)
+                        vec[cnt++] = iov[i];
+        }
+
+        while (cnt) {
+                ssize_t n = writev(w->fd, vec, cnt);
+
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+
+                /* Partial write, skip what went out */
+                for (i = 0; i < cnt && (size_t)n >= vec[i].iov_len; i++)
+                        n -= vec[i].iov_len;
+                if (i) {
+                        memmove(vec, vec + i, (cnt - i) * sizeof(struct iovec));
+                        cnt -= i;
+                }
+                if (cnt) {
+                        vec[0].iov_base = (char *)vec[0].iov_base + n;
+                        vec[0].iov_len -= n;
+                }
+        }
+
+        return 0;
+}
+
 static char *json_object_to_string(JsonObject *object)
 {
+        struct json_writer *w;
         cstring jsonstr;
         size_t len = 0;
 
         cstring_init(&jsonstr, 0);
 
-        parse_json_object(object, &jsonstr);
+        w = xmalloc(sizeof(struct json_writer));
+        json_writer_init_cstring(w, &jsonstr);
+        parse_json_object(object, w);
+        json_writer_flush(w);
+        free(w);
 
         return cstring_detach(&jsonstr, &len);
 }
 
 static JsonObject *json_obj_new(JsonType type)
 {
-        JsonObject *obj = (JsonObject *) xcalloc(1, sizeof(JsonObject));
+        JsonObject *obj;
+
+        if (json_arena_in_use) {
+                obj = json_arena_alloc(json_arena_in_use, sizeof(JsonObject));
+                memset(obj, 0, sizeof(JsonObject));
+                obj->in_arena = true;
+        } else {
+                obj = (JsonObject *) xcalloc(1, sizeof(JsonObject));
+        }
 
         obj->type = type;
 
         return obj;
 }
 
+static char *json_strdup(const char *key)
+{
+        if (json_arena_in_use)
+                return json_arena_strdup(json_arena_in_use, key);
+
+        return xstrdup(key);
+}
+
+/* Free what `obj` holds, and `obj` itself, unless it is in an arena */
+static void json_obj_release(JsonObject *obj)
+{
+        if (obj->in_arena)
+                return;
+
+        if (obj->type == JSON_STRING)
+                free(obj->str_);
+        else if (obj->type == JSON_NUMBER)
+                free(obj->lexeme_);
+        free(obj->key);
+        free(obj);
+}
+
 static void json_remove_from_parent(JsonObject *obj)
 {
         JsonObject *parent = obj->parent;
@@ -133,9 +235,10 @@ static void json_remove_from_parent(JsonObject *obj)
                 if (obj->next != NULL)
                         obj->next->prev = obj->prev;
                 else
-                        obj->children.tail = obj->prev;
+                        parent->children.tail = obj->prev;
 
-                free(obj->key);
+                if (!obj->in_arena)
+                        free(obj->key);
 
                 obj->parent = NULL;
                 obj->prev = obj->next = NULL;
@@ -143,31 +246,42 @@ static void json_remove_from_parent(JsonObject *obj)
         }
 }
 
+/* Free `obj` and everything below it, children first. The walk goes down
+ * to the first child and back up through the parent links, so no stack is
+ * needed however deep the tree is.
+ */
 static void json_obj_free(JsonObject *obj)
 {
-        if (obj) {
-                json_remove_from_parent(obj);
+        JsonObject *cur, *parent;
 
-                switch(obj->type) {
-                case JSON_STRING:
-                        free(obj->str_);
-                        break;
-                case JSON_ARRAY:
-                case JSON_OBJECT:
-                {
-                        JsonObject *child, *next;
-                        for (child = obj->children.head; child != NULL; child = next) {
-                                next = child->next;
-                                json_obj_free(child);
-                        }
-                        break;
+        if (obj == NULL)
+                return;
+
+        json_remove_from_parent(obj);
+
+        /* Nothing below it is freed before the arena is reset */
+        if (obj->in_arena)
+                return;
+
+        cur = obj;
+        for (;;) {
+                if ((cur->type == JSON_ARRAY || cur->type == JSON_OBJECT) &&
+                    cur->children.head != NULL) {
+                        cur = cur->children.head;
+                        continue;
                 }
-                default:
+
+                if (cur == obj) {
+                        json_obj_release(cur);
                         break;
                 }
 
-                free(obj);
-                obj = NULL;
+                /* cur is the first child left, unlink it */
+                parent = cur->parent;
+                parent->children.head = cur->next;
+                json_obj_release(cur);
+
+                cur = parent;
         }
 }
 
@@ -203,11 +317,231 @@ static void prepend_object(JsonObject *parent, JsonObject *child)
  * Public Functions
  */
 
+void *json_arena_alloc(struct json_arena *arena, size_t size)
+{
+        struct json_arena_chunk *c = arena->current;
+        void *p;
+
+        size = (size + 7) & ~(size_t)7;
+
+        /* Move on to the next chunk kept by a reset, or add one */
+        while (c == NULL || c->size - arena->used < size) {
+                if (c && c->next) {
+                        c = c->next;
+                } else {
+                        struct json_arena_chunk *n;
+                        size_t csize = JSON_ARENA_CHUNK_SIZE;
+
+                        if (c && c->size < JSON_ARENA_CHUNK_MAX)
+                                csize = c->size * 2;
+                        else if (c)
+                                csize = c->size;
+                        if (csize < size)
+                                csize = size;
+
+                        n = xmalloc(sizeof(struct json_arena_chunk) + csize);
+                        n->next = NULL;
+                        n->size = csize;
+                        if (c)
+                                c->next = n;
+                        else
+                                arena->chunks = n;
+                        c = n;
+                }
+                arena->used = 0;
+        }
+
+        arena->current = c;
+        p = c->data + arena->used;
+        arena->used += size;
+
+        return p;
+}
+
+char *json_arena_strdup(struct json_arena *arena, const char *str)
+{
+        size_t len = strlen(str) + 1;
+
+        return memcpy(json_arena_alloc(arena, len), str, len);
+}
+
+void json_arena_reset(struct json_arena *arena)
+{
+        arena->current = arena->chunks;
+        arena->used = 0;
+}
+
+void json_arena_release(struct json_arena *arena)
+{
+        struct json_arena_chunk *c, *next;
+
+        for (c = arena->chunks; c; c = next) {
+                next = c->next;
+                free(c);
+        }
+
+        memset(arena, 0, sizeof(struct json_arena));
+}
+
+struct json_arena *json_use_arena(struct json_arena *arena)
+{
+        struct json_arena *prev = json_arena_in_use;
+
+        json_arena_in_use = arena;
+
+        return prev;
+}
+
+char *json_str_alloc(size_t size)
+{
+        if (json_arena_in_use)
+                return json_arena_alloc(json_arena_in_use, size);
+
+        return xmalloc(size);
+}
+
+void json_str_free(char *str)
+{
+        if (json_arena_in_use == NULL)
+                free(str);
+}
+
+void json_writer_init(struct json_writer *w, json_sink_fn sink, void *data)
+{
+        w->sink = sink;
+        w->sinkdata = data;
+        w->fd = -1;
+        w->error = 0;
+        w->len = 0;
+}
+
+void json_writer_init_cstring(struct json_writer *w, cstring *str)
+{
+        json_writer_init(w, cstring_sink, str);
+}
+
+void json_writer_init_fd(struct json_writer *w, int fd)
+{
+        json_writer_init(w, fd_sink, w);
+        w->fd = fd;
+}
+
+void json_writer_add(struct json_writer *w, const char *data, size_t len)
+{
+        struct iovec iov[2];
+
+        if (len <= JSON_WRITER_BUFSIZE - w->len) {
+                memcpy(w->buf + w->len, data, len);
+                w->len += len;
+                return;
+        }
+
+        /* Top up the buffer if the rest fits in the next one, otherwise
+         * pass the data straight on after the buffered output.
+         */
+        if (len - (JSON_WRITER_BUFSIZE - w->len) < JSON_WRITER_BUFSIZE) {
+                size_t n = JSON_WRITER_BUFSIZE - w->len;
+
+                memcpy(w->buf + w->len, data, n);
+                w->len += n;
+                data += n;
+                len -= n;
+
+                iov[0].iov_base = w->buf;
+                iov[0].iov_len = w->len;
+                if (!w->error && w->sink(w->sinkdata, iov, 1) < 0)
+                        w->error = 1;
+
+                memcpy(w->buf, data, len);
+                w->len = len;
+                return;
+        }
+
+        iov[0].iov_base = w->buf;
+        iov[0].iov_len = w->len;
+        iov[1].iov_base = (void *)(uintptr_t)data;
+        iov[1].iov_len = len;
+        if (!w->error && w->sink(w->sinkdata, iov, 2) < 0)
+                w->error = 1;
+
+        w->len = 0;
+}
+
+void json_writer_add_string(struct json_writer *w, const char *s,
+                            size_t len)
+{
+        char esc[JSON_ESCAPE_MAX];
+        size_t i = 0;
+
+        /* Copy straight into the buffer while the string is clean */
+        if (len + 2 + JSON_ESCAPE_PAD <= JSON_WRITER_BUFSIZE - w->len) {
+                char *dst = w->buf + w->len;
+
+                dst[0] = '"';
+                i = json_escape_copy(dst + 1, s, len);
+                if (i == len) {
+                        dst[len + 1] = '"';
+                        w->len += len + 2;
+                        return;
+                }
+                w->len += 1 + i;
+        } else {
+                json_writer_addch(w, '"');
+        }
+
+        for (;;) {
+                size_t run = json_escape_find(s + i, len - i);
+
+                json_writer_add(w, s + i, run);
+                i += run;
+                if (i == len)
+                        break;
+
+                json_writer_add(w, esc, json_escape_char(esc, s[i]));
+                i++;
+        }
+        json_writer_addch(w, '"');
+}
+
+int json_writer_flush(struct json_writer *w)
+{
+        struct iovec iov;
+
+        if (w->len) {
+                iov.iov_base = w->buf;
+                iov.iov_len = w->len;
+                if (!w->error && w->sink(w->sinkdata, &iov, 1) < 0)
+                        w->error = 1;
+                w->len = 0;
+        }
+
+        return w->error ? -1 : 0;
+}
+
 char *json_encode(JsonObject *obj)
 {
         return json_object_to_string(obj);
 }
 
+void json_write(struct json_writer *w, JsonObject *obj)
+{
+        parse_json_object(obj, w);
+}
+
+int json_encode_to_fd(JsonObject *obj, int fd)
+{
+        struct json_writer *w;
+        int ret;
+
+        w = xmalloc(sizeof(struct json_writer));
+        json_writer_init_fd(w, fd);
+        parse_json_object(obj, w);
+        ret = json_writer_flush(w);
+        free(w);
+
+        return ret;
+}
+
 JsonObject *json_null_obj(void)
 {
         return json_obj_new(JSON_NULL);
@@ -223,7 +557,14 @@ JsonObject *json_bool_obj(bool b)
 JsonObject *json_string_obj(const char *str)
 {
         JsonObject *obj = json_obj_new(JSON_STRING);
-        obj->str_ = xstrdup(str);
+        obj->str_ = json_strdup(str);
+        return obj;
+}
+
+JsonObject *json_string_obj_take(char *str)
+{
+        JsonObject *obj = json_obj_new(JSON_STRING);
+        obj->str_ = str;
         return obj;
 }
 
@@ -234,6 +575,13 @@ JsonObject *json_num_obj(double num)
         return obj;
 }
 
+JsonObject *json_num_obj_take(char *lexeme)
+{
+        JsonObject *obj = json_obj_new(JSON_NUMBER);
+        obj->lexeme_ = lexeme;
+        return obj;
+}
+
 JsonObject *json_array_obj(void)
 {
         return json_obj_new(JSON_ARRAY);
@@ -265,7 +613,7 @@ void json_append_member(JsonObject *object, const char *key, JsonObject *value)
         assert(object->type == JSON_OBJECT);
         assert(value->parent == NULL);
 
-        value->key = xstrdup(key);
+        value->key = json_strdup(key);
         append_object(object, value);
 }
 
@@ -274,7 +622,7 @@ void json_prepend_member(JsonObject *object, const char *key, JsonObject *value)
         assert(object->type == JSON_OBJECT);
         assert(value->parent == NULL);
 
-        value->key = xstrdup(key);
+        value->key = json_strdup(key);
         prepend_object(object, value);
 }
 
@@ -6,6 +6,10 @@
 #define XML2JSON_JSON_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "cstring.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,11 +34,15 @@ struct _JsonObject {
         char *key;
 
         JsonType type;
+        bool in_arena;          /* allocated from a json_arena */
 
         union {
                 bool bool_;     /* JSON_BOOL */
                 char *str_;     /* JSON_STRING */
-                double num_;    /* JSON_NUMBER */
+                struct {        /* JSON_NUMBER */
+                        double num_;
+                        char *lexeme_;  /* written as is, if not NULL */
+                };
                 struct {        /* JSON_ARRAY * JSON_OBJECT */
                         JsonObject *head;
                         JsonObject *tail;
@@ -42,12 +50,172 @@ struct _JsonObject {
         };
 };
 
+/* JSON arenas:
+ * While a thread uses an arena, see json_use_arena(), the objects it
+ * creates, their keys and json_str_alloc() strings are carved out of large
+ * chunks of the arena instead of being allocated one by one. They are all
+ * freed at once, in constant time, by json_arena_reset(), which keeps the
+ * chunks for the next tree. json_free() of an object from an arena only
+ * detaches it from its parent, without walking the tree below it, which
+ * must be in the same arena.
+ *
+ * A zeroed struct json_arena is an empty arena.
+ */
+#define JSON_ARENA_CHUNK_SIZE (64 * 1024)
+#define JSON_ARENA_CHUNK_MAX (4 * 1024 * 1024)
+
+struct json_arena_chunk;
+
+struct json_arena {
+        struct json_arena_chunk *chunks;        /* oldest first */
+        struct json_arena_chunk *current;       /* being carved */
+        size_t used;                            /* bytes used in current */
+};
+
+/* json_arena_alloc():
+ * Allocate `size` bytes, aligned for any JSON object, from the arena.
+ */
+extern void *json_arena_alloc(struct json_arena *arena, size_t size);
+
+/* json_arena_strdup():
+ * Copy `str` into the arena.
+ */
+extern char *json_arena_strdup(struct json_arena *arena, const char *str);
+
+/* json_arena_reset():
+ * Free everything allocated from the arena, keeping its memory for the
+ * next allocations.
+ */
+extern void json_arena_reset(struct json_arena *arena);
+
+/* json_arena_release():
+ * Free everything allocated from the arena and its memory.
+ */
+extern void json_arena_release(struct json_arena *arena);
+
+/* json_use_arena():
+ * Allocate the objects the calling thread creates from `arena`, or one by
+ * one if it is NULL. Returns the arena used until now.
+ */
+extern struct json_arena *json_use_arena(struct json_arena *arena);
+
+/* json_str_alloc():
+ * Allocate a string of `size` bytes, to be handed to json_string_obj_take()
+ * or json_num_obj_take(), from the arena in use if any.
+ */
+extern char *json_str_alloc(size_t size);
+
+/* json_str_free():
+ * Free a string from json_str_alloc() that was not handed over, under the
+ * same arena.
+ */
+extern void json_str_free(char *str);
+
+/* JSON writer:
+ * Encoded JSON is collected in a fixed size buffer, which is handed to the
+ * sink whenever it fills up. The sink gets the buffered data and, when a
+ * single write does not fit in the buffer, the write itself as a second
+ * iovec, so large strings are never copied.
+ * The sink returns 0 on success and -1 on failure, after which the writer
+ * drops all further output.
+ */
+#define JSON_WRITER_BUFSIZE 65536
+
+typedef int (*json_sink_fn)(void *data, const struct iovec *iov, int iovcnt);
+
+struct json_writer {
+        json_sink_fn sink;
+        void *sinkdata;
+        int fd;
+        int error;
+        size_t len;
+        char buf[JSON_WRITER_BUFSIZE];
+};
+
+/* json_writer_init():
+ * Initialise a writer which hands its output to `sink`.
+ */
+extern void json_writer_init(struct json_writer *w, json_sink_fn sink,
+                             void *data);
+
+/* json_writer_init_cstring():
+ * Initialise a writer which appends its output to `str`.
+ */
+extern void json_writer_init_cstring(struct json_writer *w, cstring *str);
+
+/* json_writer_init_fd():
+ * Initialise a writer which write()s its output to `fd`.
+ */
+extern void json_writer_init_fd(struct json_writer *w, int fd);
+
+/* json_writer_add():
+ * Add `len` bytes of data to the writer.
+ */
+extern void json_writer_add(struct json_writer *w, const char *data,
+                            size_t len);
+
+/* json_writer_addch():
+ * Add a single character to the writer.
+ */
+static inline void json_writer_addch(struct json_writer *w, int ch)
+{
+        if (w->len == JSON_WRITER_BUFSIZE) {
+                char c = ch;
+                json_writer_add(w, &c, 1);
+                return;
+        }
+        w->buf[w->len++] = ch;
+}
+
+/* json_writer_add_string():
+ * Add the `len` bytes at `s` to the writer as a JSON string, escaping
+ * quotes, backslashes and control characters.
+ */
+extern void json_writer_add_string(struct json_writer *w, const char *s,
+                                   size_t len);
+
+/* json_writer_flush():
+ * Hand all the buffered data to the sink. Returns 0 on success, -1 if
+ * any write failed since the writer was initialised.
+ */
+extern int json_writer_flush(struct json_writer *w);
+
 extern char *json_encode(JsonObject *obj);
 
+/* json_write():
+ * Encode `obj` into the writer.
+ */
+extern void json_write(struct json_writer *w, JsonObject *obj);
+
+/* json_encode_to_fd():
+ * Encode `obj` and write it to `fd`, using a bounded amount of memory.
+ * Returns 0 on success, -1 on write errors.
+ */
+extern int json_encode_to_fd(JsonObject *obj, int fd);
+
 extern JsonObject *json_null_obj(void);
 extern JsonObject *json_bool_obj(bool b);
 extern JsonObject *json_string_obj(const char *str);
+
+/* json_string_obj_take():
+ * Create a string object which takes over `str`, from json_str_alloc() or
+ * malloc() when no arena is in use, instead of copying it.
+ */
+extern JsonObject *json_string_obj_take(char *str);
+
+/* json_num_obj():
+ * Create a number object from `num`, written by numfmt_double() when the
+ * object is encoded.
+ */
 extern JsonObject *json_num_obj(double num);
+
+/* json_num_obj_take():
+ * Create a number object written as `lexeme`, a string in JSON's number
+ * grammar which it takes over like json_string_obj_take(), so its digits
+ * are kept exactly instead of going through a double.
+ */
+extern JsonObject *json_num_obj_take(char *lexeme);
+
 extern JsonObject *json_array_obj(void);
 extern JsonObject *json_new(void);
 extern void json_free(JsonObject *obj);
@@ -0,0 +1,352 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * jsonescape - escaping of JSON string contents.
+ */
+
+#include "jsonescape.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ESC_HAVE_X86 1
+#endif
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* The primitives of escaping, one set per instruction set */
+struct esc_kernel {
+        /* Index of the first byte to escape, or `len` */
+        size_t (*find)(const char *s, size_t len);
+        /* Copy `src` to `dst` up to the first byte to escape, returns the
+         * number of bytes copied. Up to JSON_ESCAPE_PAD bytes past `len`
+         * may be written, whatever is found.
+         */
+        size_t (*copy)(char *dst, const char *src, size_t len);
+};
+
+static inline int needs_escape(unsigned char c)
+{
+        return c < 0x20 || c == '"' || c == '\\';
+}
+
+/*
+ * Scalar
+ */
+
+static size_t scalar_find(const char *s, size_t len)
+{
+        size_t i;
+
+        for (i = 0; i < len && !needs_escape(s[i]); i++)
+                ;
+        return i;
+}
+
+static size_t scalar_copy(char *dst, const char *src, size_t len)
+{
+        size_t i;
+
+        for (i = 0; i < len && !needs_escape(src[i]); i++)
+                dst[i] = src[i];
+        return i;
+}
+
+static const struct esc_kernel scalar_kernel = {
+        scalar_find,
+        scalar_copy,
+};
+
+#ifdef ESC_HAVE_X86
+
+/*
+ * SSE2, 16 bytes at a time
+ */
+
+/* Bit mask of the bytes of a block to escape: quotes, backslashes and
+ * bytes up to 0x1f, compared unsigned so UTF-8 bytes do not match.
+ */
+__attribute__((target("sse2")))
+static inline uint32_t sse2_mask_of(__m128i v)
+{
+        __m128i ctrl = _mm_set1_epi8(0x1f);
+        __m128i m;
+
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+
+        return (uint32_t)_mm_movemask_epi8(m);
+}
+
+__attribute__((target("sse2")))
+static inline uint32_t sse2_mask(const char *s)
+{
+        return sse2_mask_of(_mm_loadu_si128((const __m128i *)
+                                            (const void *)s));
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_find(const char *s, size_t len)
+{
+        size_t i;
+
+        for (i = 0; i + 16 <= len; i += 16) {
+                uint32_t mask = sse2_mask(s + i);
+
+                if (mask)
+                        return i + __builtin_ctz(mask);
+        }
+
+        return i + scalar_find(s + i, len - i);
+}
+
+/* Most strings are short, copy them as one block if reading the 16
+ * bytes at `src` cannot cross into the next page. `dst` has room for
+ * them. An empty string may end right at a page, it reads nothing.
+ */
+__attribute__((target("sse2"), no_sanitize_address))
+static size_t sse2_copy_short(char *dst, const char *src, size_t len)
+{
+        uint32_t mask;
+        __m128i v;
+
+        if (len == 0)
+                return 0;
+        if (((uintptr_t)src & 4095) > 4096 - 16)
+                return scalar_copy(dst, src, len);
+
+        v = _mm_loadu_si128((const __m128i *)(const void *)src);
+        _mm_storeu_si128((__m128i *)(void *)dst, v);
+        mask = sse2_mask_of(v) | (1U << len);
+
+        return __builtin_ctz(mask);
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_copy(char *dst, const char *src, size_t len)
+{
+        uint32_t mask;
+        size_t i;
+
+        if (len < 16)
+                return sse2_copy_short(dst, src, len);
+
+        for (i = 0; i + 16 <= len; i += 16) {
+                _mm_storeu_si128((__m128i *)(void *)(dst + i),
+                                 _mm_loadu_si128((const __m128i *)
+                                                 (const void *)(src + i)));
+                mask = sse2_mask(src + i);
+                if (mask)
+                        return i + __builtin_ctz(mask);
+        }
+        if (i == len)
+                return len;
+
+        /* The last block overlaps the one before, whose bytes are known
+         * to be clean, so its first match is past them.
+         */
+        i = len - 16;
+        _mm_storeu_si128((__m128i *)(void *)(dst + i),
+                         _mm_loadu_si128((const __m128i *)
+                                         (const void *)(src + i)));
+        mask = sse2_mask(src + i);
+
+        return mask ? i + __builtin_ctz(mask) : len;
+}
+
+static const struct esc_kernel sse2_kernel = {
+        sse2_find,
+        sse2_copy,
+};
+
+/*
+ * AVX2, 32 bytes at a time
+ */
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2_mask(const char *s)
+{
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)s);
+        __m256i ctrl = _mm256_set1_epi8(0x1f);
+        __m256i m;
+
+        m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl),
+                                                 v));
+
+        return (uint32_t)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_find(const char *s, size_t len)
+{
+        size_t i;
+
+        for (i = 0; i + 32 <= len; i += 32) {
+                uint32_t mask = avx2_mask(s + i);
+
+                if (mask)
+                        return i + __builtin_ctz(mask);
+        }
+
+        /* Leave the AVX state before the SSE2 tail, mixing the two costs
+         * far more than the scan.
+         */
+        _mm256_zeroupper();
+        return i + sse2_find(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_copy(char *dst, const char *src, size_t len)
+{
+        uint32_t mask;
+        size_t i;
+
+        if (len < 32)
+                return sse2_copy(dst, src, len);
+
+        for (i = 0; i + 32 <= len; i += 32) {
+                _mm256_storeu_si256((__m256i *)(void *)(dst + i),
+                                    _mm256_loadu_si256((const __m256i *)
+                                                       (const void *)
+                                                       (src + i)));
+                mask = avx2_mask(src + i);
+                if (mask)
+                        goto out;
+        }
+        if (i == len) {
+                mask = 0;
+                goto out;
+        }
+
+        i = len - 32;
+        _mm256_storeu_si256((__m256i *)(void *)(dst + i),
+                            _mm256_loadu_si256((const __m256i *)
+                                               (const void *)(src + i)));
+        mask = avx2_mask(src + i);
+out:
+        _mm256_zeroupper();
+        return mask ? i + __builtin_ctz(mask) : len;
+}
+
+static const struct esc_kernel avx2_kernel = {
+        avx2_find,
+        avx2_copy,
+};
+
+#endif  /* ESC_HAVE_X86 */
+
+static const struct esc_kernel *kernel = &scalar_kernel;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void esc_select_kernel(void)
+{
+#ifdef ESC_HAVE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+                kernel = &avx2_kernel;
+        else if (__builtin_cpu_supports("sse2"))
+                kernel = &sse2_kernel;
+#endif
+}
+
+/*
+ * Public Functions
+ */
+
+size_t json_escape_find(const char *s, size_t len)
+{
+        pthread_once(&kernel_once, esc_select_kernel);
+
+        return kernel->find(s, len);
+}
+
+size_t json_escape_copy(char *dst, const char *src, size_t len)
+{
+        pthread_once(&kernel_once, esc_select_kernel);
+
+        return kernel->copy(dst, src, len);
+}
+
+size_t json_escape_char(char *dst, unsigned char c)
+{
+        dst[0] = '\\';
+
+        switch (c) {
+        case '"':
+        case '\\':
+                dst[1] = c;
+                return 2;
+        case '\b':
+                dst[1] = 'b';
+                return 2;
+        case '\f':
+                dst[1] = 'f';
+                return 2;
+        case '\n':
+                dst[1] = 'n';
+                return 2;
+        case '\r':
+                dst[1] = 'r';
+                return 2;
+        case '\t':
+                dst[1] = 't';
+                return 2;
+        default:
+                break;
+        }
+
+        dst[1] = 'u';
+        dst[2] = '0';
+        dst[3] = '0';
+        dst[4] = hex_digits[c >> 4];
+        dst[5] = hex_digits[c & 0xf];
+
+        return JSON_ESCAPE_MAX;
+}
+
+void json_escape_cstring(cstring *out, const char *s, size_t len)
+{
+        size_t i = 0;
+
+        for (;;) {
+                size_t run = json_escape_find(s + i, len - i);
+
+                cstring_add(out, s + i, run);
+                i += run;
+                if (i == len)
+                        break;
+
+                cstring_grow(out, JSON_ESCAPE_MAX);
+                cstring_setlen(out, out->len +
+                               json_escape_char(out->buf + out->len, s[i]));
+                i++;
+        }
+}
+
+int json_escape_use_kernel(const char *isa)
+{
+        pthread_once(&kernel_once, esc_select_kernel);
+
+        if (strcmp(isa, "scalar") == 0) {
+                kernel = &scalar_kernel;
+                return 0;
+        }
+#ifdef ESC_HAVE_X86
+        if (strcmp(isa, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+                kernel = &sse2_kernel;
+                return 0;
+        }
+        if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+                kernel = &avx2_kernel;
+                return 0;
+        }
+#endif
+
+        return -1;
+}
@@ -0,0 +1,64 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * jsonescape - escaping of JSON string contents.
+ */
+
+#ifndef XML2JSON_JSONESCAPE_H
+#define XML2JSON_JSONESCAPE_H
+
+#include "cstring.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Longest escape sequence of a single byte, \u00XX */
+#define JSON_ESCAPE_MAX 6
+
+/* Bytes json_escape_copy() may write past the end of the string */
+#define JSON_ESCAPE_PAD 16
+
+/* json_escape_find():
+ * Returns the index of the first of the `len` bytes at `s` which has to
+ * be escaped in a JSON string, i.e. a quote, a backslash or a control
+ * character, or `len` if there is none. Bytes of UTF-8 sequences are
+ * written as they are.
+ */
+extern size_t json_escape_find(const char *s, size_t len);
+
+/* json_escape_copy():
+ * Copy the `len` bytes at `src` to `dst` up to the first one which has to
+ * be escaped, and return how many were copied. `dst` must have room for
+ * `len` + JSON_ESCAPE_PAD bytes, all of which may be written. For text
+ * without escapes this is a memcpy() which checks the bytes on the way.
+ */
+extern size_t json_escape_copy(char *dst, const char *src, size_t len);
+
+/* json_escape_char():
+ * Write the escape sequence of `c` to `dst`, which must have room for
+ * JSON_ESCAPE_MAX bytes. Returns the length of the sequence.
+ */
+extern size_t json_escape_char(char *dst, unsigned char c);
+
+/* json_escape_cstring():
+ * Append the `len` bytes at `s` to `out`, escaped for a JSON string. The
+ * quotes around the string are not added.
+ */
+extern void json_escape_cstring(cstring *out, const char *s, size_t len);
+
+/* json_escape_use_kernel():
+ * Scan strings with the "scalar", "sse2" or "avx2" kernel from now on,
+ * instead of the one picked for the CPU, so tests can compare them.
+ * Returns 0 on success, -1 if the name is unknown or the CPU can't run
+ * the kernel.
+ */
+extern int json_escape_use_kernel(const char *isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_JSONESCAPE_H */
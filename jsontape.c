@@ -0,0 +1,174 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * jsontape - JSON documents as a flat tape of 64 bit words.
+ */
+
+#include "jsontape.h"
+
+#include "util.h"
+
+#include <string.h>
+
+static inline void tape_add(struct json_tape *tape, int tag,
+                            uint64_t payload)
+{
+        ALLOC_GROW(tape->words, tape->nr_words + 1, tape->alloc_words);
+        tape->words[tape->nr_words++] =
+                ((uint64_t)tag << TAPE_TAG_SHIFT) | payload;
+}
+
+/* Copy `prefix` and `len` bytes at `s` into the string buffer, returns
+ * their offset.
+ */
+static uint64_t tape_add_bytes(struct json_tape *tape, const char *prefix,
+                               const char *s, size_t len)
+{
+        size_t plen = prefix ? strlen(prefix) : 0;
+        size_t off = tape->len_strings;
+        uint32_t n = plen + len;
+        char *p;
+
+        ALLOC_GROW(tape->strings, off + sizeof(uint32_t) + n,
+                   tape->alloc_strings);
+        p = tape->strings + off;
+        memcpy(p, &n, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+        if (plen)
+                memcpy(p, prefix, plen);
+        memcpy(p + plen, s, len);
+        tape->len_strings = off + sizeof(uint32_t) + n;
+
+        return off;
+}
+
+static inline const char *tape_bytes(const struct json_tape *tape,
+                                     uint64_t word, uint32_t *len)
+{
+        const char *p = tape->strings + TAPE_PAYLOAD(word);
+
+        memcpy(len, p, sizeof(uint32_t));
+
+        return p + sizeof(uint32_t);
+}
+
+/*
+ * Public Functions
+ */
+
+void json_tape_init(struct json_tape *tape)
+{
+        memset(tape, 0, sizeof(struct json_tape));
+}
+
+void json_tape_reset(struct json_tape *tape)
+{
+        tape->nr_words = 0;
+        tape->len_strings = 0;
+        tape->nr_open = 0;
+}
+
+void json_tape_release(struct json_tape *tape)
+{
+        free(tape->words);
+        free(tape->strings);
+        free(tape->open);
+        json_tape_init(tape);
+}
+
+void json_tape_open(struct json_tape *tape, int tag)
+{
+        ALLOC_GROW(tape->open, tape->nr_open + 1, tape->alloc_open);
+        tape->open[tape->nr_open++] = tape->nr_words;
+        tape_add(tape, tag, 0);
+}
+
+void json_tape_close(struct json_tape *tape)
+{
+        size_t start = tape->open[--tape->nr_open];
+        int tag = TAPE_TAG(tape->words[start]) == '{' ? '}' : ']';
+
+        tape->words[start] |= tape->nr_words;
+        tape_add(tape, tag, start);
+}
+
+void json_tape_key(struct json_tape *tape, const char *prefix,
+                   const char *key, size_t len)
+{
+        tape_add(tape, 'k', tape_add_bytes(tape, prefix, key, len));
+}
+
+void json_tape_string(struct json_tape *tape, const char *s, size_t len)
+{
+        tape_add(tape, '"', tape_add_bytes(tape, NULL, s, len));
+}
+
+void json_tape_number(struct json_tape *tape, const char *s, size_t len)
+{
+        tape_add(tape, 'd', tape_add_bytes(tape, NULL, s, len));
+}
+
+void json_tape_bool(struct json_tape *tape, int b)
+{
+        tape_add(tape, b ? 't' : 'f', 0);
+}
+
+void json_tape_null(struct json_tape *tape)
+{
+        tape_add(tape, 'n', 0);
+}
+
+void json_tape_write(const struct json_tape *tape, struct json_writer *w)
+{
+        int comma = 0;          /* a value was written before this word */
+        size_t i;
+
+        for (i = 0; i < tape->nr_words; i++) {
+                uint64_t word = tape->words[i];
+                int tag = TAPE_TAG(word);
+                const char *s;
+                uint32_t len;
+
+                if (tag == '}' || tag == ']') {
+                        json_writer_addch(w, tag);
+                        comma = 1;
+                        continue;
+                }
+
+                if (comma)
+                        json_writer_addch(w, ',');
+                comma = 1;
+
+                switch (tag) {
+                case '{':
+                case '[':
+                        json_writer_addch(w, tag);
+                        comma = 0;
+                        break;
+                case 'k':
+                        s = tape_bytes(tape, word, &len);
+                        json_writer_add_string(w, s, len);
+                        json_writer_addch(w, ':');
+                        comma = 0;
+                        break;
+                case '"':
+                        s = tape_bytes(tape, word, &len);
+                        json_writer_add_string(w, s, len);
+                        break;
+                case 'd':
+                        s = tape_bytes(tape, word, &len);
+                        json_writer_add(w, s, len);
+                        break;
+                case 't':
+                        json_writer_add(w, "true", 4);
+                        break;
+                case 'f':
+                        json_writer_add(w, "false", 5);
+                        break;
+                case 'n':
+                default:
+                        json_writer_add(w, "null", 4);
+                        break;
+                }
+        }
+}
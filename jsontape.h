@@ -0,0 +1,118 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * jsontape - JSON documents as a flat tape of 64 bit words.
+ */
+
+#ifndef XML2JSON_JSONTAPE_H
+#define XML2JSON_JSONTAPE_H
+
+#include "json.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Every value of a document is one word of the tape, or two for objects
+ * and arrays, in document order. The top 8 bits of a word are its tag,
+ * the other 56 its payload:
+ *
+ *   '{' '['    the index of the matching '}' or ']'
+ *   '}' ']'    the index of the matching '{' or '['
+ *   '"' 'k'    a string or a member key, the offset of its length in
+ *              the string buffer, followed by its bytes
+ *   'd'        a number, like a string, written as it is
+ *   't' 'f' 'n' true, false and null, no payload
+ *
+ * A member is a key word followed by the words of its value. Strings,
+ * keys and numbers live in one buffer, each one as a 32 bit length and
+ * its bytes.
+ */
+#define TAPE_TAG_SHIFT 56
+#define TAPE_PAYLOAD_MASK ((UINT64_C(1) << TAPE_TAG_SHIFT) - 1)
+
+#define TAPE_TAG(word) ((unsigned char)((word) >> TAPE_TAG_SHIFT))
+#define TAPE_PAYLOAD(word) ((word) & TAPE_PAYLOAD_MASK)
+
+struct json_tape {
+        uint64_t *words;
+        size_t nr_words, alloc_words;
+
+        char *strings;
+        size_t len_strings, alloc_strings;
+
+        /* Containers being built, by the index of their opening word */
+        size_t *open;
+        size_t nr_open, alloc_open;
+};
+
+/* json_tape_init():
+ * Initialise an empty tape.
+ */
+extern void json_tape_init(struct json_tape *tape);
+
+/* json_tape_reset():
+ * Empty the tape, keeping its memory for the next document.
+ */
+extern void json_tape_reset(struct json_tape *tape);
+
+/* json_tape_release():
+ * Release all the memory held by the tape.
+ */
+extern void json_tape_release(struct json_tape *tape);
+
+/* json_tape_open():
+ * Start an object, with `tag` '{', or an array, with '['.
+ */
+extern void json_tape_open(struct json_tape *tape, int tag);
+
+/* json_tape_close():
+ * End the innermost object or array.
+ */
+extern void json_tape_close(struct json_tape *tape);
+
+/* json_tape_key():
+ * Add the key of the next member of the object being built: `prefix`,
+ * which may be NULL, followed by the `len` bytes at `key`.
+ */
+extern void json_tape_key(struct json_tape *tape, const char *prefix,
+                          const char *key, size_t len);
+
+/* json_tape_string():
+ * Add a string, of the `len` bytes at `s`.
+ */
+extern void json_tape_string(struct json_tape *tape, const char *s,
+                             size_t len);
+
+/* json_tape_number():
+ * Add a number, written as the `len` bytes at `s`, which must follow
+ * JSON's number grammar.
+ */
+extern void json_tape_number(struct json_tape *tape, const char *s,
+                             size_t len);
+
+/* json_tape_bool():
+ * Add true or false.
+ */
+extern void json_tape_bool(struct json_tape *tape, int b);
+
+/* json_tape_null():
+ * Add null.
+ */
+extern void json_tape_null(struct json_tape *tape);
+
+/* json_tape_write():
+ * Encode the tape into the writer, in one pass from its first word to
+ * its last. All objects and arrays must have been closed.
+ */
+extern void json_tape_write(const struct json_tape *tape,
+                            struct json_writer *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_JSONTAPE_H */
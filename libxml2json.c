@@ -0,0 +1,128 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * libxml2json - public interface of the conversion library.
+ */
+
+#include "libxml2json.h"
+
+#include "converter.h"
+#include "json.h"
+#include "util.h"
+
+#include <string.h>
+
+#include <libxml/parser.h>
+
+struct xml2json_converter {
+        struct converter conv;
+
+        xml2json_sink_fn sink;
+        void *sinkdata;
+        struct json_writer w;
+};
+
+/* Pass the writer's output on to the caller's sink */
+static int converter_sink(void *data, const struct iovec *iov, int iovcnt)
+{
+        struct xml2json_converter *c = data;
+        int i;
+
+        for (i = 0; i < iovcnt; i++) {
+                if (iov[i].iov_len == 0)
+                        continue;
+                if (c->sink(c->sinkdata, iov[i].iov_base, iov[i].iov_len) < 0)
+                        return -1;
+        }
+
+        return 0;
+}
+
+/*
+ * Public Functions
+ */
+
+struct xml2json_converter *
+xml2json_converter_new(const struct xml2json_opts *opts)
+{
+        struct xml2json_converter *c;
+
+        xmlInitParser();
+
+        c = xmalloc(sizeof(struct xml2json_converter));
+        if (converter_init(&c->conv, opts ? opts->xsdfile : NULL,
+                           opts ? opts->xsd_table : NULL,
+                           opts ? opts->xml_options : 0) < 0) {
+                free(c);
+                return NULL;
+        }
+        if (opts) {
+                c->conv.ws_mode = (enum ws_mode)opts->whitespace;
+                c->conv.infer_types = opts->infer_types;
+                c->conv.xsd_types = opts->xsd_types;
+                c->conv.xsd_arrays = opts->xsd_arrays;
+        }
+
+        return c;
+}
+
+struct xml2json_converter *
+xml2json_converter_clone(const struct xml2json_converter *src)
+{
+        struct xml2json_converter *c;
+
+        c = xmalloc(sizeof(struct xml2json_converter));
+        if (converter_clone(&c->conv, &src->conv) < 0) {
+                free(c);
+                return NULL;
+        }
+
+        return c;
+}
+
+int xml2json_converter_convert(struct xml2json_converter *c, const char *xml,
+                               size_t len, xml2json_sink_fn sink, void *data)
+{
+        int ret;
+
+        c->sink = sink;
+        c->sinkdata = data;
+        json_writer_init(&c->w, converter_sink, c);
+
+        ret = converter_convert_buffer(&c->conv, xml, len, "<buffer>", &c->w);
+        if (ret == CONVERT_INVALID)
+                ret = XML2JSON_INVALID;
+        if (json_writer_flush(&c->w) < 0)
+                ret = -1;
+
+        c->sink = NULL;
+        c->sinkdata = NULL;
+
+        return ret;
+}
+
+void xml2json_converter_free(struct xml2json_converter *c)
+{
+        if (c == NULL)
+                return;
+
+        converter_release(&c->conv);
+        free(c);
+}
+
+int xml2json_convert(const char *xml, size_t len,
+                     const struct xml2json_opts *opts,
+                     xml2json_sink_fn sink, void *data)
+{
+        struct xml2json_converter *c;
+        int ret;
+
+        c = xml2json_converter_new(opts);
+        if (c == NULL)
+                return -1;
+
+        ret = xml2json_converter_convert(c, xml, len, sink, data);
+        xml2json_converter_free(c);
+
+        return ret;
+}
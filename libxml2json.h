@@ -0,0 +1,96 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * libxml2json - public interface of the conversion library.
+ */
+
+#ifndef XML2JSON_LIBXML2JSON_H
+#define XML2JSON_LIBXML2JSON_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define XML2JSON_API __attribute__((visibility("default")))
+#else
+#define XML2JSON_API
+#endif
+
+/* White space handling in text, see xml2json --whitespace */
+#define XML2JSON_WS_STRIP       0       /* the default */
+#define XML2JSON_WS_TRIM        1
+#define XML2JSON_WS_COLLAPSE    2
+#define XML2JSON_WS_PRESERVE    3
+
+struct xml2json_opts {
+        const char *xsdfile;    /* schema to validate against, or NULL */
+        const char *xsd_table;  /* from xml2json --compile-schema, or NULL */
+        int xml_options;        /* libxml2 xmlParserOption flags */
+        int whitespace;         /* XML2JSON_WS_* */
+        int infer_types;        /* numbers and booleans, see --infer-types */
+        int xsd_types;          /* types from the schema, see --xsd-types */
+        int xsd_arrays;         /* arrays from the schema, see --xsd-arrays */
+};
+
+/* Returned by the conversion functions for a document that was converted
+ * but fails to validate against the schema.
+ */
+#define XML2JSON_INVALID        1
+
+/* Receives the JSON as it is produced, in pieces of `len` bytes. Returns 0
+ * on success and -1 to make the conversion fail.
+ */
+typedef int (*xml2json_sink_fn)(void *data, const char *buf, size_t len);
+
+/* A converter keeps its parser context, output buffer and parsed schema
+ * between conversions. It can only be used by one thread at a time.
+ */
+struct xml2json_converter;
+
+/* xml2json_converter_new():
+ * Create a converter. `opts` may be NULL for the defaults. Returns NULL if
+ * the schema could not be parsed.
+ */
+XML2JSON_API extern struct xml2json_converter *
+xml2json_converter_new(const struct xml2json_opts *opts);
+
+/* xml2json_converter_clone():
+ * Create a converter sharing the schema of `src`, for use on another
+ * thread. `src` must outlive the clone.
+ */
+XML2JSON_API extern struct xml2json_converter *
+xml2json_converter_clone(const struct xml2json_converter *src);
+
+/* xml2json_converter_convert():
+ * Convert the document of `len` bytes at `xml` and hand the JSON, followed
+ * by a newline, to `sink`. All of the output has been passed to the sink
+ * when this returns. Returns 0 on success, XML2JSON_INVALID if the document
+ * was converted but fails to validate, and -1 if it is not well formed or
+ * the sink failed. Validation errors are not printed.
+ */
+XML2JSON_API extern int
+xml2json_converter_convert(struct xml2json_converter *c, const char *xml,
+                           size_t len, xml2json_sink_fn sink, void *data);
+
+/* xml2json_converter_free():
+ * Release the converter.
+ */
+XML2JSON_API extern void
+xml2json_converter_free(struct xml2json_converter *c);
+
+/* xml2json_convert():
+ * Convert a single document with a temporary converter. Use a converter
+ * handle instead when converting more than one document.
+ */
+XML2JSON_API extern int
+xml2json_convert(const char *xml, size_t len, const struct xml2json_opts *opts,
+                 xml2json_sink_fn sink, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_LIBXML2JSON_H */
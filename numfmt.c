@@ -0,0 +1,425 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * numfmt - formatting of numbers as JSON.
+ */
+
+#include "numfmt.h"
+
+#include <math.h>
+#include <string.h>
+
+static const char digit_pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+/*
+ * Grisu2
+ *
+ * A double is turned into the shortest digits which still fall between
+ * the midpoints to its neighbours, using 64 bit arithmetic and a table of
+ * cached powers of ten, without the bignums of a printf(). The digits
+ * always read back as the same double; in rare cases a shorter string
+ * would have done too.
+ */
+
+#define DP_SIGNIFICAND_MASK UINT64_C(0x000fffffffffffff)
+#define DP_HIDDEN_BIT UINT64_C(0x0010000000000000)
+#define DP_EXPONENT_BIAS (0x3ff + 52)
+#define DP_MIN_EXPONENT (-DP_EXPONENT_BIAS)
+
+/* A floating point number f * 2^e with a 64 bit significand */
+struct diy_fp {
+        uint64_t f;
+        int e;
+};
+
+/* 10^(-348 + 8 * i), normalised, as diy_fp.f and diy_fp.e */
+static const uint64_t cached_powers_f[] = {
+        UINT64_C(0xfa8fd5a0081c0288), UINT64_C(0xbaaee17fa23ebf76),
+        UINT64_C(0x8b16fb203055ac76), UINT64_C(0xcf42894a5dce35ea),
+        UINT64_C(0x9a6bb0aa55653b2d), UINT64_C(0xe61acf033d1a45df),
+        UINT64_C(0xab70fe17c79ac6ca), UINT64_C(0xff77b1fcbebcdc4f),
+        UINT64_C(0xbe5691ef416bd60c), UINT64_C(0x8dd01fad907ffc3c),
+        UINT64_C(0xd3515c2831559a83), UINT64_C(0x9d71ac8fada6c9b5),
+        UINT64_C(0xea9c227723ee8bcb), UINT64_C(0xaecc49914078536d),
+        UINT64_C(0x823c12795db6ce57), UINT64_C(0xc21094364dfb5637),
+        UINT64_C(0x9096ea6f3848984f), UINT64_C(0xd77485cb25823ac7),
+        UINT64_C(0xa086cfcd97bf97f4), UINT64_C(0xef340a98172aace5),
+        UINT64_C(0xb23867fb2a35b28e), UINT64_C(0x84c8d4dfd2c63f3b),
+        UINT64_C(0xc5dd44271ad3cdba), UINT64_C(0x936b9fcebb25c996),
+        UINT64_C(0xdbac6c247d62a584), UINT64_C(0xa3ab66580d5fdaf6),
+        UINT64_C(0xf3e2f893dec3f126), UINT64_C(0xb5b5ada8aaff80b8),
+        UINT64_C(0x87625f056c7c4a8b), UINT64_C(0xc9bcff6034c13053),
+        UINT64_C(0x964e858c91ba2655), UINT64_C(0xdff9772470297ebd),
+        UINT64_C(0xa6dfbd9fb8e5b88f), UINT64_C(0xf8a95fcf88747d94),
+        UINT64_C(0xb94470938fa89bcf), UINT64_C(0x8a08f0f8bf0f156b),
+        UINT64_C(0xcdb02555653131b6), UINT64_C(0x993fe2c6d07b7fac),
+        UINT64_C(0xe45c10c42a2b3b06), UINT64_C(0xaa242499697392d3),
+        UINT64_C(0xfd87b5f28300ca0e), UINT64_C(0xbce5086492111aeb),
+        UINT64_C(0x8cbccc096f5088cc), UINT64_C(0xd1b71758e219652c),
+        UINT64_C(0x9c40000000000000), UINT64_C(0xe8d4a51000000000),
+        UINT64_C(0xad78ebc5ac620000), UINT64_C(0x813f3978f8940984),
+        UINT64_C(0xc097ce7bc90715b3), UINT64_C(0x8f7e32ce7bea5c70),
+        UINT64_C(0xd5d238a4abe98068), UINT64_C(0x9f4f2726179a2245),
+        UINT64_C(0xed63a231d4c4fb27), UINT64_C(0xb0de65388cc8ada8),
+        UINT64_C(0x83c7088e1aab65db), UINT64_C(0xc45d1df942711d9a),
+        UINT64_C(0x924d692ca61be758), UINT64_C(0xda01ee641a708dea),
+        UINT64_C(0xa26da3999aef774a), UINT64_C(0xf209787bb47d6b85),
+        UINT64_C(0xb454e4a179dd1877), UINT64_C(0x865b86925b9bc5c2),
+        UINT64_C(0xc83553c5c8965d3d), UINT64_C(0x952ab45cfa97a0b3),
+        UINT64_C(0xde469fbd99a05fe3), UINT64_C(0xa59bc234db398c25),
+        UINT64_C(0xf6c69a72a3989f5c), UINT64_C(0xb7dcbf5354e9bece),
+        UINT64_C(0x88fcf317f22241e2), UINT64_C(0xcc20ce9bd35c78a5),
+        UINT64_C(0x98165af37b2153df), UINT64_C(0xe2a0b5dc971f303a),
+        UINT64_C(0xa8d9d1535ce3b396), UINT64_C(0xfb9b7cd9a4a7443c),
+        UINT64_C(0xbb764c4ca7a44410), UINT64_C(0x8bab8eefb6409c1a),
+        UINT64_C(0xd01fef10a657842c), UINT64_C(0x9b10a4e5e9913129),
+        UINT64_C(0xe7109bfba19c0c9d), UINT64_C(0xac2820d9623bf429),
+        UINT64_C(0x80444b5e7aa7cf85), UINT64_C(0xbf21e44003acdd2d),
+        UINT64_C(0x8e679c2f5e44ff8f), UINT64_C(0xd433179d9c8cb841),
+        UINT64_C(0x9e19db92b4e31ba9), UINT64_C(0xeb96bf6ebadf77d9),
+        UINT64_C(0xaf87023b9bf0ee6b)
+};
+
+static const int16_t cached_powers_e[] = {
+        -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+        -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+        -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+        -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+        -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+        109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+        375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+        641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+        907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint64_t pow10_u64[] = {
+        UINT64_C(1), UINT64_C(10), UINT64_C(100), UINT64_C(1000),
+        UINT64_C(10000), UINT64_C(100000), UINT64_C(1000000),
+        UINT64_C(10000000), UINT64_C(100000000), UINT64_C(1000000000),
+        UINT64_C(10000000000), UINT64_C(100000000000),
+        UINT64_C(1000000000000), UINT64_C(10000000000000),
+        UINT64_C(100000000000000), UINT64_C(1000000000000000),
+        UINT64_C(10000000000000000), UINT64_C(100000000000000000),
+        UINT64_C(1000000000000000000), UINT64_C(10000000000000000000),
+};
+
+static struct diy_fp diy_fp_of(double d)
+{
+        struct diy_fp v;
+        uint64_t bits;
+        int biased_e;
+
+        memcpy(&bits, &d, sizeof(bits));
+        biased_e = (bits >> 52) & 0x7ff;
+        if (biased_e) {
+                v.f = (bits & DP_SIGNIFICAND_MASK) | DP_HIDDEN_BIT;
+                v.e = biased_e - DP_EXPONENT_BIAS;
+        } else {
+                v.f = bits & DP_SIGNIFICAND_MASK;
+                v.e = DP_MIN_EXPONENT + 1;
+        }
+
+        return v;
+}
+
+static inline struct diy_fp diy_fp_normalize(struct diy_fp v)
+{
+        int s = __builtin_clzll(v.f);
+
+        v.f <<= s;
+        v.e -= s;
+
+        return v;
+}
+
+/* The product, rounded to its top 64 bits */
+static inline struct diy_fp diy_fp_mul(struct diy_fp a, struct diy_fp b)
+{
+        __extension__ typedef unsigned __int128 u128;
+        u128 p = (u128)a.f * b.f;
+        struct diy_fp r;
+
+        r.f = (uint64_t)(p >> 64) + (((uint64_t)p >> 63) & 1);
+        r.e = a.e + b.e + 64;
+
+        return r;
+}
+
+/* The midpoints between `v` and its neighbours, with the exponent of the
+ * normalised upper one.
+ */
+static void diy_fp_boundaries(struct diy_fp v, struct diy_fp *minus,
+                              struct diy_fp *plus)
+{
+        struct diy_fp pl, mi;
+
+        pl.f = (v.f << 1) + 1;
+        pl.e = v.e - 1;
+        pl = diy_fp_normalize(pl);
+
+        /* Powers of two are closer to their lower neighbour */
+        if (v.f == DP_HIDDEN_BIT) {
+                mi.f = (v.f << 2) - 1;
+                mi.e = v.e - 2;
+        } else {
+                mi.f = (v.f << 1) - 1;
+                mi.e = v.e - 1;
+        }
+        mi.f <<= mi.e - pl.e;
+        mi.e = pl.e;
+
+        *minus = mi;
+        *plus = pl;
+}
+
+/* The cached power c with 10^k = 1 / c, which brings a number with binary
+ * exponent `e` into the range where its digits can be generated.
+ */
+static struct diy_fp cached_power(int e, int *k)
+{
+        double dk = (-61 - e) * 0.30102999566398114 + 347;
+        int ik = (int)dk;
+        unsigned int index;
+        struct diy_fp c;
+
+        if (dk - ik > 0.0)
+                ik++;
+
+        index = (ik >> 3) + 1;
+        *k = -(-348 + (int)index * 8);
+
+        c.f = cached_powers_f[index];
+        c.e = cached_powers_e[index];
+
+        return c;
+}
+
+/* Move the last digit towards the exact value while it stays within the
+ * boundaries.
+ */
+static void grisu_round(char *buf, int len, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w)
+{
+        while (rest < wp_w && delta - rest >= ten_kappa &&
+               (rest + ten_kappa < wp_w ||
+                wp_w - rest > rest + ten_kappa - wp_w)) {
+                buf[len - 1]--;
+                rest += ten_kappa;
+        }
+}
+
+static inline int count_digits32(uint32_t n)
+{
+        int i;
+
+        for (i = 1; i < 10 && n >= pow10_u64[i]; i++)
+                ;
+        return i;
+}
+
+static void digit_gen(struct diy_fp w, struct diy_fp mp, uint64_t delta,
+                      char *buf, int *len, int *k)
+{
+        int shift = -mp.e;
+        uint64_t one = UINT64_C(1) << shift;
+        uint64_t wp_w = mp.f - w.f;
+        uint32_t p1 = (uint32_t)(mp.f >> shift);
+        uint64_t p2 = mp.f & (one - 1);
+        int kappa = count_digits32(p1);
+
+        *len = 0;
+
+        /* Integral part */
+        while (kappa > 0) {
+                uint32_t div = pow10_u64[kappa - 1];
+                uint32_t d = p1 / div;
+                uint64_t rest;
+
+                p1 %= div;
+                if (d || *len)
+                        buf[(*len)++] = '0' + d;
+                kappa--;
+
+                rest = ((uint64_t)p1 << shift) + p2;
+                if (rest <= delta) {
+                        *k += kappa;
+                        grisu_round(buf, *len, delta, rest,
+                                    pow10_u64[kappa] << shift, wp_w);
+                        return;
+                }
+        }
+
+        /* Fractional part */
+        for (;;) {
+                int d;
+
+                p2 *= 10;
+                delta *= 10;
+                d = (int)(p2 >> shift);
+                if (d || *len)
+                        buf[(*len)++] = '0' + d;
+                p2 &= one - 1;
+                kappa--;
+                if (p2 < delta) {
+                        *k += kappa;
+                        grisu_round(buf, *len, delta, p2, one,
+                                    -kappa < 20 ? wp_w * pow10_u64[-kappa] : 0);
+                        return;
+                }
+        }
+}
+
+/* Digits of the positive, finite `d` into `buf`, d = buf * 10^k */
+static int grisu2(double d, char *buf, int *k)
+{
+        struct diy_fp v = diy_fp_of(d);
+        struct diy_fp w_m, w_p, c_mk, w;
+        int len;
+
+        diy_fp_boundaries(v, &w_m, &w_p);
+        c_mk = cached_power(w_p.e, k);
+
+        w = diy_fp_mul(diy_fp_normalize(v), c_mk);
+        w_p = diy_fp_mul(w_p, c_mk);
+        w_m = diy_fp_mul(w_m, c_mk);
+        w_m.f++;
+        w_p.f--;
+
+        digit_gen(w, w_p, w_p.f - w_m.f, buf, &len, k);
+
+        return len;
+}
+
+/* Lay out the `len` digits of `digits` * 10^k */
+static size_t format_decimal(char *buf, const char *digits, int len, int k)
+{
+        int point = len + k;   /* digits before the decimal point */
+        size_t n = 0;
+        int exp;
+
+        if (len <= point && point <= 21) {
+                /* 1234e2 -> 123400 */
+                memcpy(buf, digits, len);
+                memset(buf + len, '0', point - len);
+                return point;
+        }
+
+        if (0 < point && point <= 21) {
+                /* 1234e-2 -> 12.34 */
+                memcpy(buf, digits, point);
+                buf[point] = '.';
+                memcpy(buf + point + 1, digits + point, len - point);
+                return len + 1;
+        }
+
+        if (-6 < point && point <= 0) {
+                /* 1234e-6 -> 0.001234 */
+                buf[0] = '0';
+                buf[1] = '.';
+                memset(buf + 2, '0', -point);
+                memcpy(buf + 2 - point, digits, len);
+                return len + 2 - point;
+        }
+
+        /* 1234e-10 -> 1.234e-7, 1e30 -> 1e+30 */
+        buf[n++] = digits[0];
+        if (len > 1) {
+                buf[n++] = '.';
+                memcpy(buf + n, digits + 1, len - 1);
+                n += len - 1;
+        }
+        buf[n++] = 'e';
+        exp = point - 1;
+        if (exp < 0) {
+                buf[n++] = '-';
+                exp = -exp;
+        } else {
+                buf[n++] = '+';
+        }
+        if (exp >= 100) {
+                buf[n++] = '0' + exp / 100;
+                exp %= 100;
+                memcpy(buf + n, digit_pairs + exp * 2, 2);
+                n += 2;
+        } else if (exp >= 10) {
+                memcpy(buf + n, digit_pairs + exp * 2, 2);
+                n += 2;
+        } else {
+                buf[n++] = '0' + exp;
+        }
+
+        return n;
+}
+
+/*
+ * Public Functions
+ */
+
+size_t numfmt_int(char *buf, int64_t v)
+{
+        uint64_t u = v < 0 ? -(uint64_t)v : (uint64_t)v;
+        char tmp[20];
+        char *p = tmp + sizeof(tmp);
+        size_t n = 0;
+
+        while (u >= 100) {
+                p -= 2;
+                memcpy(p, digit_pairs + (u % 100) * 2, 2);
+                u /= 100;
+        }
+        if (u >= 10) {
+                p -= 2;
+                memcpy(p, digit_pairs + u * 2, 2);
+        } else {
+                *--p = '0' + u;
+        }
+
+        if (v < 0)
+                buf[n++] = '-';
+        memcpy(buf + n, p, tmp + sizeof(tmp) - p);
+
+        return n + (tmp + sizeof(tmp) - p);
+}
+
+size_t numfmt_double(char *buf, double d)
+{
+        char digits[20];
+        size_t n = 0;
+        int len, k;
+
+        if (!isfinite(d)) {
+                memcpy(buf, "null", 4);
+                return 4;
+        }
+
+        if (d == 0) {
+                if (signbit(d))
+                        buf[n++] = '-';
+                buf[n++] = '0';
+                return n;
+        }
+
+        /* Integers are exact as doubles up to 2^53 */
+        if (d > -9007199254740992.0 && d < 9007199254740992.0 &&
+            d == (double)(int64_t)d)
+                return numfmt_int(buf, (int64_t)d);
+
+        if (d < 0) {
+                buf[n++] = '-';
+                d = -d;
+        }
+
+        len = grisu2(d, digits, &k);
+
+        return n + format_decimal(buf + n, digits, len, k);
+}
@@ -0,0 +1,44 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * numfmt - formatting of numbers as JSON.
+ */
+
+#ifndef XML2JSON_NUMFMT_H
+#define XML2JSON_NUMFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Room for any number written by the functions below */
+#define NUMFMT_MAX 32
+
+/* numfmt_int():
+ * Write `v` in decimal to `buf`, which must have room for NUMFMT_MAX
+ * bytes. Returns the length written, no NUL is added.
+ */
+extern size_t numfmt_int(char *buf, int64_t v);
+
+/* numfmt_double():
+ * Write `d` to `buf`, which must have room for NUMFMT_MAX bytes, as a
+ * JSON number which round-trips: it always reads back as `d`, and is
+ * usually the shortest such number, Grisu2 writes a few more digits for
+ * a fraction of a percent of doubles. The layout is that of JavaScript's
+ * Number.prototype.toString(): 100, 0.001, 1.5e+300. Integral values
+ * below 2^53 go through numfmt_int(). JSON has no NaN or infinities, they
+ * are written as null. Returns the length written, no NUL is added.
+ *
+ * Only json_num_obj() numbers are written this way. The converter keeps
+ * the numbers of a document as they were written, see json_num_obj_take().
+ */
+extern size_t numfmt_double(char *buf, double d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_NUMFMT_H */
@@ -11,6 +11,8 @@
 
 #include "parsexsd.h"
 
+#define XSD_NAMESPACE "http://www.w3.org/2001/XMLSchema"
+
 static void print(xmlNodePtr node);
 
 /* Walk the XSD tree and build a list of all the elements that are defined as arrayrs in xsd
@@ -20,12 +22,11 @@ static void print(xmlNodePtr node);
  * minO - minimum occurence
  * maxO - maximum occurence
  */
-xmlArrayDefPtr xsdmaproot = NULL ;
-xmlChar nullstring[1] = "\0" ;
-char complexName[100];
+static xmlChar nullstring[1] = "\0" ;
 
-int buildArrayTree(xmlChar* complexNamein, xmlChar* elemName, xmlChar* minOin,
-                   xmlChar* maxOin, xmlChar* typein)
+int buildArrayTree(struct xsd_model *model, xmlChar* complexNamein,
+                   xmlChar* elemName, xmlChar* minOin, xmlChar* maxOin,
+                   xmlChar* typein)
 {
         xmlArrayDefPtr t = malloc(sizeof(struct xmlArrayDef));
         t->elemName = malloc(sizeof(char)*100);
@@ -34,16 +35,14 @@ int buildArrayTree(xmlChar* complexNamein, xmlChar* elemName, xmlChar* minOin,
         t->minOccurs = -1;
         t->maxOccurs = 0;
         t->isArray = 0;
+        t->owner = model->owner;
+        t->ref = NULL;
         t->next = NULL;
-        xmlArrayDefPtr r = NULL;
-        xmlChar *ubound = "unbounded";
 
         strcpy((char*)t->complexName, (char*)complexNamein);
         strcpy((char*)t->elemName, (char*)elemName);
         strcpy((char*)t->type, (char*)typein);
 
-        if(strlen((char*)complexNamein) == 0) strcpy((char*)complexNamein, "root");
-
         if(strlen((char*)minOin) == 0) strcpy((char*)minOin, "0");
         t->minOccurs = strtol((char*)minOin,NULL,10);
         if (errno == EINVAL) {
@@ -55,7 +54,9 @@ int buildArrayTree(xmlChar* complexNamein, xmlChar* elemName, xmlChar* minOin,
 
         /* -99 is an arbitary negative number, as XSD comes with "unbound", the size of array is platform dependent
          * also, this number has little or no impact in conversion" */
-        if(xmlStrEqual(maxOin, (xmlChar*)&ubound))  strcpy((char*)maxOin, "-99");
+        if(xmlStrEqual(maxOin, (const xmlChar *)"unbounded") ||
+           model->repeated)
+                strcpy((char*)maxOin, "-99");
 
         t->maxOccurs = strtol((char*)maxOin,NULL,10);
         if (errno == EINVAL){
@@ -63,41 +64,78 @@ int buildArrayTree(xmlChar* complexNamein, xmlChar* elemName, xmlChar* minOin,
                 return 0;
         }
 
-        /* minOccurs = 0 && maxOccurs > 1 - optional or an array
-           minOccurs = +{d,>1}  - mandatory and an array
-           minOccurs > 1 && maxOccurs > 1 - mandatory and array */
+        /* maxOccurs > 1 or unbounded - an array, optional if
+           minOccurs = 0 and mandatory otherwise
+           minOccurs > 1 - mandatory and an array */
 
-        if(t->minOccurs == 0 && t->maxOccurs > 1)
-                t->isArray = OPTIONAL_OR_ARRAY ;
+        if (t->maxOccurs > 1 || t->maxOccurs == -99)
+                t->isArray = t->minOccurs == 0 ?
+                        OPTIONAL_OR_ARRAY : MANDATORY_AND_ARRAY;
 
-        if((t->minOccurs > 1) || ( t->minOccurs > 1 && t->maxOccurs > 1))
+        if (t->minOccurs > 1)
                 t->isArray = MANDATORY_AND_ARRAY ;
 
-        if(xsdmaproot == NULL) {
-                xsdmaproot = t;
-                return 1;
-        } else {
-                for(r=xsdmaproot ; r->next ; r=r->next);
-                r->next=t ;
-                return 1;
-        }
+        if(model->root == NULL)
+                model->root = t;
+        else
+                model->tail->next = t;
+        model->tail = t;
+        model->nr_elements++;
+
+        return 1;
 }
 
 xmlChar* getType(xmlNodePtr node)
 {
         xmlAttrPtr anode = node->properties;
-        xmlChar *xsdType = "type";
+        const xmlChar *xsdType = (const xmlChar *)"type";
 
-        while(!(xmlStrEqual((xmlChar*)&xsdType,anode->name)) && anode->next)
+        while(!(xmlStrEqual(xsdType,anode->name)) && anode->next)
                 anode=anode->next;
 
-        if (xmlStrEqual((xmlChar*)&xsdType,anode->name) &&
+        if (xmlStrEqual(xsdType,anode->name) &&
             anode != NULL && anode->children != NULL)
                 return (xmlChar*) anode->children->content;
 
         return (xmlChar*)&nullstring;
 }
 
+/* Resolve `qname`, as it appears in an attribute of node, into `out`:
+ * built-in types become "xs:<name>", whatever the prefix the schema binds
+ * to the XSD namespace, and other names their local name, which is how
+ * named complex types are recorded.
+ */
+static void resolveQName(xmlNodePtr node, const xmlChar *qname, char *out,
+                         size_t size)
+{
+        const xmlChar *local = xmlStrchr(qname, ':');
+        xmlChar *prefix = NULL;
+        xmlNsPtr ns;
+
+        if (local) {
+                prefix = xmlStrndup(qname, local - qname);
+                local++;
+        } else {
+                local = qname;
+        }
+
+        ns = xmlSearchNs(node->doc, node, prefix);
+        xmlFree(prefix);
+
+        if (*local && ns &&
+            xmlStrEqual(ns->href, (const xmlChar *)XSD_NAMESPACE))
+                snprintf(out, size, "xs:%s", (const char *)local);
+        else
+                snprintf(out, size, "%s", (const char *)local);
+}
+
+/* Resolve the QName in the type attribute of node into `out`, see
+ * resolveQName().
+ */
+void resolveType(xmlNodePtr node, char *out, size_t size)
+{
+        resolveQName(node, getType(node), out, size);
+}
 
 /* Given a node, get the complex type assosiated with it by traversing to
  * parent or previous
@@ -159,12 +197,74 @@ xmlChar* getElementName(xmlNodePtr node)
               anode->next)
                 anode=anode->next;
 
-        if (anode != NULL && anode->children != NULL)
+        if (xmlStrEqual((const xmlChar*)"name",anode->name) &&
+            anode->children != NULL)
                 return (xmlChar*) anode->children->content;
 
         return (xmlChar*)&nullstring;
 }
 
+/* Find the top level declaration `kind` (complexType or group) called
+ * `name` in the schema of node.
+ */
+static xmlNodePtr findGlobal(xmlNodePtr node, const char *kind,
+                             const xmlChar *name)
+{
+        xmlNodePtr t = xmlDocGetRootElement(node->doc);
+
+        for (t = t ? t->children : NULL; t; t = t->next) {
+                xmlChar *tname;
+                int found;
+
+                if (t->type != XML_ELEMENT_NODE ||
+                    !xmlStrEqual(t->name, (const xmlChar *)kind))
+                        continue;
+
+                tname = xmlGetProp(t, (const xmlChar *)"name");
+                found = xmlStrEqual(tname, name);
+                xmlFree(tname);
+                if (found)
+                        return t;
+        }
+
+        return NULL;
+}
+
+/* The declaration whose content node stands for: the named complex type
+ * an extension derives from, or the group a group refers to.
+ */
+static xmlNodePtr getExpansion(xmlNodePtr node)
+{
+        char name[100];
+        xmlChar *qname;
+
+        if (xmlStrEqual(node->name, (const xmlChar *)"extension")) {
+                qname = xmlGetProp(node, (const xmlChar *)"base");
+                if (qname == NULL)
+                        return NULL;
+                resolveQName(node, qname, name, sizeof(name));
+                xmlFree(qname);
+
+                /* Built-in types have no content of their own */
+                if (strncmp(name, "xs:", 3) == 0)
+                        return NULL;
+
+                return findGlobal(node, "complexType", (xmlChar *)name);
+        }
+
+        if (xmlStrEqual(node->name, (const xmlChar *)"group")) {
+                qname = xmlGetProp(node, (const xmlChar *)"ref");
+                if (qname == NULL)
+                        return NULL;
+                resolveQName(node, qname, name, sizeof(name));
+                xmlFree(qname);
+
+                return findGlobal(node, "group", (xmlChar *)name);
+        }
+
+        return NULL;
+}
+
 /* Given a node, get min occurs property */
 
 xmlChar* getMinOccurs(xmlNodePtr node)
@@ -200,8 +300,33 @@ xmlChar* getMaxOccurs(xmlNodePtr node)
         return (xmlChar*)&nullstring;
 }
 
+/* Is node a sequence, choice, all or group which may repeat, making every
+ * element in it repeat too?
+ */
+int isRepeatedGroup(xmlNodePtr node)
+{
+        xmlChar *maxO;
+        int ret;
+
+        if (!xmlStrEqual(node->name, (const xmlChar *)"sequence") &&
+            !xmlStrEqual(node->name, (const xmlChar *)"choice") &&
+            !xmlStrEqual(node->name, (const xmlChar *)"all") &&
+            !xmlStrEqual(node->name, (const xmlChar *)"group"))
+                return 0;
+
+        maxO = xmlGetProp(node, (const xmlChar *)"maxOccurs");
+        if (maxO == NULL)
+                return 0;
+
+        ret = xmlStrEqual(maxO, (const xmlChar *)"unbounded") ||
+                strtol((char *)maxO, NULL, 10) > 1;
+        xmlFree(maxO);
+
+        return ret;
+}
+
 /* Walk the xsd schema and build a list of required name and properties */
-int walkXsdSchema(xmlNodePtr root)
+int walkXsdSchema(struct xsd_model *model, xmlNodePtr root)
 {
         xmlNodePtr node;
         char elementName[100];
@@ -216,52 +341,127 @@ int walkXsdSchema(xmlNodePtr root)
         xmlChar *xsdeType = "element";
 
         for (node = root; node; node = node->next) {
-                if (xmlStrEqual(node->name, xsdcType)) {
-                        strcpy(complexName, (char*)getComplexTypeName(node));
+                char saved[100];
+                int is_complex = xmlStrEqual(node->name, xsdcType);
+                int is_group = isRepeatedGroup(node);
+                int saved_repeated = model->repeated;
+                long saved_owner = model->owner;
+                long saved_element = model->element;
+                xmlChar *ref = NULL;
+                xmlNodePtr expansion;
+
+                /* Named groups only declare elements where they are
+                 * referred to.
+                 */
+                if (xmlStrEqual(node->name, (const xmlChar *)"group") &&
+                    xmlHasProp(node, (const xmlChar *)"name"))
+                        continue;
+
+                /* The elements of a complex type belong to the type's name
+                 * for named types, or to the element declaring an
+                 * anonymous one, until the type ends.
+                 */
+                if (is_complex) {
+                        xmlChar *name = xmlGetProp(node,
+                                                   (const xmlChar *)"name");
+
+                        strcpy(saved, model->complexName);
+                        if (name) {
+                                snprintf(model->complexName,
+                                         sizeof(model->complexName), "%s",
+                                         (char *)name);
+                                model->owner = 0;
+                        } else {
+                                model->complexName[0] = '\0';
+                                model->owner = model->element;
+                        }
+                        xmlFree(name);
+                        model->repeated = 0;
                 }
 
+                if (is_group)
+                        model->repeated = 1;
+
                 if (xmlStrEqual(node->name, xsdeType) &&
                     node->properties != NULL)  {
                         print(root);
                         strcpy(elementName, (char*)getElementName(node)) ;
                         strcpy(minO, (char*)getMinOccurs(node));
                         strcpy(maxO, (char*)getMaxOccurs(node));
-                        if (!(buildArrayTree((xmlChar*)complexName,
+                        resolveType(node, gtype, sizeof(gtype));
+
+                        /* A reference has the name of the global element
+                         * it refers to, whose type is found once all of
+                         * them are known, see xsd_table_build().
+                         */
+                        ref = xmlGetProp(node, (const xmlChar *)"ref");
+                        if (ref)
+                                resolveQName(node, ref, elementName,
+                                             sizeof(elementName));
+                        if (!(buildArrayTree(model,
+                                             (xmlChar*)model->complexName,
                                              (xmlChar*)elementName,
                                              (xmlChar*)minO, (xmlChar*)maxO,
-                                             getType(node)))) {
-                                memset( complexName, '\0', sizeof(char)*100 );
+                                             (xmlChar*)gtype))) {
+                                memset( model->complexName, '\0', sizeof(char)*100 );
                                 exit(0); /* XXX: Cleanup?? */
                         }
+                        model->tail->ref = ref ?
+                                xmlStrdup((xmlChar *)elementName) : NULL;
+                        xmlFree(ref);
+                        model->element = model->nr_elements;
                 }
-                walkXsdSchema(node->children);
+
+                /* The content of a base type comes before that of the
+                 * extension, both belong to the type being walked.
+                 */
+                expansion = getExpansion(node);
+                if (expansion && model->expanding < XSD_MAX_EXPANSION) {
+                        model->expanding++;
+                        walkXsdSchema(model, expansion->children);
+                        model->expanding--;
+                }
+                walkXsdSchema(model, node->children);
+
+                if (is_complex)
+                        strcpy(model->complexName, saved);
+                model->repeated = saved_repeated;
+                model->owner = saved_owner;
+                model->element = saved_element;
         }
 
         return (1);
 }
 
 /* print the build list -- debuging */
-void print_array_elements(void)
+void print_array_elements(const struct xsd_model *model)
 {
         xmlArrayDefPtr t;
 
-        for (t=xsdmaproot; t; t=t->next)
-                printf("%s -> %s [ %lu , %d ] %s, %d\n", t->complexName,
-                       t->elemName, t->minOccurs, t->maxOccurs, t->type,
-                       t->isArray);
+        for (t=model->root; t; t=t->next)
+                printf("%s#%ld -> %s [ %lu , %d ] %s, %d\n", t->complexName,
+                       t->owner, t->elemName, t->minOccurs, t->maxOccurs,
+                       t->type, t->isArray);
 
 }
 
-void xsdschemafree(void)
+void xsdschemafree(struct xsd_model *model)
 {
-        xmlArrayDefPtr t=xsdmaproot;
+        xmlArrayDefPtr t=model->root;
         xmlArrayDefPtr j=NULL;
 
         while (t) {
                 j = t;
                 t=j->next;
+                free(j->elemName);
+                free(j->complexName);
+                free(j->type);
+                xmlFree(j->ref);
                 free(j);
         }
+
+        model->root = NULL;
+        model->tail = NULL;
 }
 
 
@@ -6,7 +6,6 @@
 
 #ifndef XML2JSON_XSD_H
 #define XML2JSON_XSD_H
-#endif
 
 #define LIBXML_SCHEMAS_ENABLED
 #include <libxml/xmlschemastypes.h>
@@ -22,20 +21,25 @@ extern "C" {
 #endif
 
 
+struct xsd_model;
+
 /*prototypes */
 
 xmlChar* getMinOccurs(xmlNodePtr node);
 xmlChar* getMaxOccurs(xmlNodePtr node);
-extern void print_array_elements(void);
+extern void print_array_elements(const struct xsd_model *model);
 xmlChar* getElementName(xmlNodePtr node);
 xmlChar* getSchemaName(xmlNodePtr node);
 xmlChar* getComplexTypeName(xmlNodePtr node);
 xmlChar* getType(xmlNodePtr node);
-extern int walkXsdSchema(xmlNodePtr root);
-extern void xsdschemafree(void);
+void resolveType(xmlNodePtr node, char *out, size_t size);
+int isRepeatedGroup(xmlNodePtr node);
+extern int walkXsdSchema(struct xsd_model *model, xmlNodePtr root);
+extern void xsdschemafree(struct xsd_model *model);
 
-int buildArrayTree(xmlChar* complexName, xmlChar* elemName, xmlChar* minO,
-                   xmlChar* maxO, xmlChar* type);
+int buildArrayTree(struct xsd_model *model, xmlChar* complexName,
+                   xmlChar* elemName, xmlChar* minO, xmlChar* maxO,
+                   xmlChar* type);
 
 /* Array type - based on the min/max combinations following are the outcomes */
 
@@ -53,17 +57,45 @@ enum arraytype {
  */
 
 struct xmlArrayDef {
-        xmlChar* complexName;
+        xmlChar* complexName;           /* named type declaring it, or "" */
         xmlChar* elemName;
-        xmlChar* type;
+        xmlChar* type;                  /* resolved, see resolveType() */
         long minOccurs;
         int maxOccurs;
         enum arraytype isArray;
+        long owner;                     /* 1 + index of the element whose
+                                           anonymous type declares it, or 0 */
+        xmlChar* ref;                   /* local name of the global element
+                                           it refers to, or NULL */
         struct xmlArrayDef *next;
 };
 
 typedef struct xmlArrayDef *xmlArrayDefPtr;
 
+/* The elements collected from one XSD. All the state of a walk lives here,
+ * so different schemas can be walked, and a walked schema used, from
+ * several threads.
+ */
+struct xsd_model {
+        xmlArrayDefPtr root;
+        xmlArrayDefPtr tail;            /* last element, appended to */
+        char complexName[100];          /* named complex type being
+                                           walked, or "" */
+        long owner;                     /* owner of the elements walked */
+        long nr_elements;
+        long element;                   /* 1 + index of the element whose
+                                           children are walked, or 0 */
+        int repeated;                   /* in a sequence or choice which
+                                           may repeat */
+        int expanding;                  /* base types and groups being
+                                           walked in place of a reference */
+};
+
+/* How deep base types and groups are followed, deeper ones are circular */
+#define XSD_MAX_EXPANSION 32
+
 #ifdef __cplusplus
 }
 #endif
+
+#endif  /* XML2JSON_XSD_H */
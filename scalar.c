@@ -0,0 +1,301 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * scalar - recognise JSON numbers and booleans in text.
+ */
+
+#include "scalar.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* "true" and the start of "false" as loaded into a word */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TRUE_WORD 0x65757274u
+#define FALS_WORD 0x736c6166u
+#else
+#define TRUE_WORD 0x74727565u
+#define FALS_WORD 0x66616c73u
+#endif
+
+/* Byte classes */
+enum {
+        C_OTHER,
+        C_MINUS,
+        C_PLUS,
+        C_ZERO,
+        C_DIGIT,                /* 1 to 9 */
+        C_DOT,
+        C_EXP,                  /* e or E */
+        NR_CLASSES,
+};
+
+/* States of the number grammar */
+enum {
+        S_START,
+        S_MINUS,
+        S_ZERO,                 /* accepts */
+        S_INT,                  /* accepts */
+        S_DOT,
+        S_FRAC,                 /* accepts */
+        S_EXP,
+        S_EXP_SIGN,
+        S_EXP_DIGITS,           /* accepts */
+        S_FAIL,
+        NR_STATES,
+};
+
+static const uint8_t byte_class[256] = {
+        ['-'] = C_MINUS, ['+'] = C_PLUS, ['0'] = C_ZERO,
+        ['1'] = C_DIGIT, ['2'] = C_DIGIT, ['3'] = C_DIGIT, ['4'] = C_DIGIT,
+        ['5'] = C_DIGIT, ['6'] = C_DIGIT, ['7'] = C_DIGIT, ['8'] = C_DIGIT,
+        ['9'] = C_DIGIT, ['.'] = C_DOT, ['e'] = C_EXP, ['E'] = C_EXP,
+};
+
+#define F S_FAIL
+static const uint8_t transition[NR_STATES][NR_CLASSES] = {
+        /*               other minus plus zero  digit    dot    exp */
+        [S_START]     = { F, S_MINUS, F, S_ZERO, S_INT,  F,     F },
+        [S_MINUS]     = { F, F,       F, S_ZERO, S_INT,  F,     F },
+        [S_ZERO]      = { F, F,       F, F,      F,      S_DOT, S_EXP },
+        [S_INT]       = { F, F,       F, S_INT,  S_INT,  S_DOT, S_EXP },
+        [S_DOT]       = { F, F,       F, S_FRAC, S_FRAC, F,     F },
+        [S_FRAC]      = { F, F,       F, S_FRAC, S_FRAC, F,     S_EXP },
+        [S_EXP]       = { F, S_EXP_SIGN, S_EXP_SIGN, S_EXP_DIGITS,
+                          S_EXP_DIGITS, F, F },
+        [S_EXP_SIGN]  = { F, F,       F, S_EXP_DIGITS, S_EXP_DIGITS, F, F },
+        [S_EXP_DIGITS] = { F, F,      F, S_EXP_DIGITS, S_EXP_DIGITS, F, F },
+};
+#undef F
+
+static const uint8_t accepting[NR_STATES] = {
+        [S_ZERO] = 1, [S_INT] = 1, [S_FRAC] = 1, [S_EXP_DIGITS] = 1,
+};
+
+/* Skip the digits at the start of `s`, up to `len` bytes */
+static inline size_t skip_digits(const char *s, size_t len)
+{
+        size_t i = 0;
+
+#ifdef __SSE2__
+        const __m128i zero = _mm_set1_epi8('0' - 1);
+        const __m128i nine = _mm_set1_epi8('9' + 1);
+
+        for (; i + 16 <= len; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)
+                                            (const void *)(s + i));
+                __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, zero),
+                                              _mm_cmplt_epi8(v, nine));
+                unsigned int mask = _mm_movemask_epi8(digit) ^ 0xffff;
+
+                if (mask)
+                        return i + __builtin_ctz(mask);
+        }
+#endif
+        while (i < len && (unsigned char)(s[i] - '0') < 10)
+                i++;
+
+        return i;
+}
+
+#ifdef __SSE2__
+/* Load the 16 bytes at `s`, of which only the first `len` matter, without
+ * reading across a page boundary past them. The bytes past `len` may be
+ * outside the buffer, hidden from AddressSanitizer.
+ */
+__attribute__((no_sanitize_address))
+static inline __m128i load_short(const char *s, size_t len)
+{
+        char buf[16];
+
+        if (((uintptr_t)s & 4095) <= 4096 - 16)
+                return _mm_loadu_si128((const __m128i *)(const void *)s);
+
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, s, len);
+        return _mm_loadu_si128((const __m128i *)(const void *)buf);
+}
+
+static inline unsigned int match(__m128i v, char c)
+{
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+/* Check the number grammar on up to 16 bytes at once: every byte is
+ * classified into a bit mask, and each rule of the grammar becomes a test
+ * on the masks.
+ */
+__attribute__((no_sanitize_address))
+static int is_short_number(const char *s, size_t len)
+{
+        __m128i v = load_short(s, len);
+        unsigned int valid = (1u << len) - 1;
+        unsigned int digit, zero, minus, plus, sign, dot, exp, after_exp;
+        unsigned int first, last, bad;
+
+        digit = _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                              _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1))));
+        digit &= valid;
+        zero = match(v, '0') & valid;
+        minus = match(v, '-') & valid;
+        plus = match(v, '+') & valid;
+        dot = match(v, '.') & valid;
+        exp = (match(v, 'e') | match(v, 'E')) & valid;
+        sign = minus | plus;
+        after_exp = exp << 1;
+
+        first = 1u << (minus & 1);      /* first digit of the integer */
+        last = 1u << (len - 1);
+
+        bad = valid & ~(digit | sign | dot | exp);
+        bad |= (dot & (dot - 1)) | (exp & (exp - 1));  /* at most one */
+        bad |= sign & ~after_exp & ~(minus & 1);        /* misplaced sign */
+        bad |= first & ~digit;
+        bad |= (first & zero) && (first << 1) & digit;  /* leading zero */
+        bad |= exp && dot > exp;                        /* fraction after */
+        bad |= ((dot << 1) | (dot >> 1) | (exp >> 1)) & ~digit;
+        bad |= after_exp & ~(digit | sign);
+        bad |= ((after_exp & sign) << 1) & ~digit;
+        bad |= last & ~digit;
+
+        return bad == 0;
+}
+#endif
+
+/*
+ * Public Functions
+ */
+
+enum scalar_type scalar_classify(const char *s, size_t len)
+{
+        unsigned int state = S_START;
+        size_t i;
+
+        if (len == 0)
+                return SCALAR_STRING;
+
+        if (s[0] == 't' || s[0] == 'f') {
+                uint32_t w;
+
+                if (len != 4 && len != 5)
+                        return SCALAR_STRING;
+
+                memcpy(&w, s, 4);
+                if (len == 4 ? w == TRUE_WORD :
+                    w == FALS_WORD && s[4] == 'e')
+                        return SCALAR_BOOL;
+                return SCALAR_STRING;
+        }
+
+#ifdef __SSE2__
+        if (len <= 16)
+                return is_short_number(s, len) ? SCALAR_NUMBER : SCALAR_STRING;
+#endif
+
+        for (i = 0; i < len; i++) {
+                state = transition[state][byte_class[(unsigned char)s[i]]];
+                if (state == S_FAIL)
+                        return SCALAR_STRING;
+
+                /* Long numbers are mostly digits, skip them in blocks */
+                if (state == S_INT || state == S_FRAC ||
+                    state == S_EXP_DIGITS)
+                        i += skip_digits(s + i + 1, len - i - 1);
+        }
+
+        return accepting[state] ? SCALAR_NUMBER : SCALAR_STRING;
+}
+
+static inline int is_digit(char c)
+{
+        return (unsigned char)(c - '0') < 10;
+}
+
+size_t scalar_xsd_number(char *s, size_t len, unsigned int parts)
+{
+        size_t i = 0, w = 0, int_start, int_end, frac_start, frac_end;
+        size_t exp_start = 0, exp_end = 0;
+        int neg = 0;
+
+        if (i < len && (s[i] == '+' || s[i] == '-'))
+                neg = (s[i++] == '-');
+
+        int_start = i;
+        while (i < len && is_digit(s[i]))
+                i++;
+        int_end = i;
+
+        frac_start = frac_end = i;
+        if ((parts & SCALAR_FRACTION) && i < len && s[i] == '.') {
+                frac_start = ++i;
+                while (i < len && is_digit(s[i]))
+                        i++;
+                frac_end = i;
+        }
+
+        if (int_start == int_end && frac_start == frac_end)
+                return 0;
+
+        if ((parts & SCALAR_EXPONENT) && i < len &&
+            (s[i] == 'e' || s[i] == 'E')) {
+                exp_start = ++i;
+                if (i < len && (s[i] == '+' || s[i] == '-'))
+                        i++;
+                if (i == len || !is_digit(s[i]))
+                        return 0;
+                while (i < len && is_digit(s[i]))
+                        i++;
+                exp_end = i;
+        }
+
+        if (i != len)
+                return 0;
+
+        /* Everything moves towards the start, only the zero of ".5" has to
+         * be inserted afterwards.
+         */
+        while (int_end - int_start > 1 && s[int_start] == '0')
+                int_start++;
+
+        if (neg)
+                s[w++] = '-';
+        memmove(s + w, s + int_start, int_end - int_start);
+        w += int_end - int_start;
+
+        if (frac_end > frac_start) {
+                s[w++] = '.';
+                memmove(s + w, s + frac_start, frac_end - frac_start);
+                w += frac_end - frac_start;
+        }
+
+        if (exp_end) {
+                s[w++] = 'e';
+                memmove(s + w, s + exp_start, exp_end - exp_start);
+                w += exp_end - exp_start;
+        }
+
+        if (int_end == int_start) {
+                memmove(s + neg + 1, s + neg, w - neg);
+                s[neg] = '0';
+                w++;
+        }
+
+        return w;
+}
+
+int scalar_xsd_boolean(const char *s, size_t len)
+{
+        if ((len == 4 && memcmp(s, "true", 4) == 0) ||
+            (len == 1 && s[0] == '1'))
+                return 1;
+        if ((len == 5 && memcmp(s, "false", 5) == 0) ||
+            (len == 1 && s[0] == '0'))
+                return 0;
+
+        return -1;
+}
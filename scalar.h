@@ -0,0 +1,58 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * scalar - recognise JSON numbers and booleans in text.
+ */
+
+#ifndef XML2JSON_SCALAR_H
+#define XML2JSON_SCALAR_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum scalar_type {
+        SCALAR_STRING,          /* anything else */
+        SCALAR_NUMBER,          /* a number in JSON's grammar */
+        SCALAR_BOOL,            /* true or false */
+};
+
+/* scalar_classify():
+ * Returns the JSON type the `len` bytes of text at `s` can be written as,
+ * unchanged. Numbers follow JSON's grammar exactly: an optional minus, an
+ * integer without leading zeros, an optional fraction and an optional
+ * exponent; "+1", "1.", ".5", "0x10" or "NaN" stay strings. Booleans are
+ * "true" and "false", in lower case.
+ *
+ * Bytes are classified through a lookup table driving a small state
+ * machine, and runs of digits are skipped 16 bytes at a time with SSE2.
+ */
+extern enum scalar_type scalar_classify(const char *s, size_t len);
+
+/* Parts a number may have in scalar_xsd_number() */
+#define SCALAR_FRACTION 0x1
+#define SCALAR_EXPONENT 0x2
+
+/* scalar_xsd_number():
+ * Rewrite the `len` bytes at `s`, an XSD integer, decimal, float or double
+ * value according to `parts`, as a JSON number in place: a plus sign and
+ * leading zeros are dropped, "1." becomes "1" and ".5" becomes "0.5". `s`
+ * must have room for len + 1 bytes. Returns the new length, or 0 if the
+ * text is not such a number; "INF" and "NaN" are not, as JSON has no way
+ * to write them.
+ */
+extern size_t scalar_xsd_number(char *s, size_t len, unsigned int parts);
+
+/* scalar_xsd_boolean():
+ * Returns 1 for an XSD true value ("true" or "1"), 0 for a false value
+ * ("false" or "0") and -1 otherwise.
+ */
+extern int scalar_xsd_boolean(const char *s, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_SCALAR_H */
@@ -0,0 +1,551 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * server - convert documents sent over a Unix domain socket.
+ */
+
+#include "server.h"
+
+#include "cstring.h"
+#include "util.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Latencies are counted in nanoseconds, in log2 buckets each split into
+ * four linear sub-buckets, so percentiles are accurate to within 25%.
+ */
+#define LATENCY_SUB_BITS 2
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB)
+
+/* Requests are read in pieces of at most this many bytes */
+#define SERVER_READ_CHUNK (64 * 1024)
+
+struct server;
+
+struct server_worker {
+        struct server *srv;
+        struct converter conv;
+        struct json_writer w;
+        cstring in;
+        cstring out;
+
+        /* Updated by the worker, read by whichever worker serves a
+         * statistics request.
+         */
+        uint64_t requests;
+        uint64_t errors;
+        uint64_t latency[LATENCY_BUCKETS];
+};
+
+struct server {
+        int fd;
+        struct server_worker *workers;
+        size_t nr_workers;
+};
+
+static unsigned int latency_bucket(uint64_t ns)
+{
+        unsigned int msb;
+
+        if (ns < LATENCY_SUB)
+                return ns;
+
+        msb = 63 - __builtin_clzll(ns);
+        return (msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB +
+                ((ns >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB - 1));
+}
+
+/* Smallest latency counted in `bucket` */
+static uint64_t latency_bucket_start(unsigned int bucket)
+{
+        unsigned int msb, sub;
+
+        if (bucket < LATENCY_SUB)
+                return bucket;
+
+        msb = bucket / LATENCY_SUB + LATENCY_SUB_BITS - 1;
+        sub = bucket % LATENCY_SUB;
+        return (uint64_t)(LATENCY_SUB + sub) << (msb - LATENCY_SUB_BITS);
+}
+
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void counter_inc(uint64_t *counter)
+{
+        __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t counter_get(const uint64_t *counter)
+{
+        return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/* Upper bound, in microseconds, of the latency below which `fraction` of
+ * the requests completed.
+ */
+static double latency_percentile(const uint64_t *hist, uint64_t total,
+                                 double fraction)
+{
+        uint64_t rank = (uint64_t)(fraction * total + 0.5), seen = 0;
+        unsigned int b;
+
+        if (rank == 0)
+                rank = 1;
+
+        for (b = 0; b < LATENCY_BUCKETS - 1; b++) {
+                seen += hist[b];
+                if (seen >= rank)
+                        break;
+        }
+
+        return latency_bucket_start(b + 1) / 1000.0;
+}
+
+static void server_stats(struct server *srv, cstring *out)
+{
+        uint64_t hist[LATENCY_BUCKETS] = { 0 };
+        uint64_t requests = 0, errors = 0, total = 0;
+        char buf[256];
+        size_t i;
+        unsigned int b;
+
+        for (i = 0; i < srv->nr_workers; i++) {
+                struct server_worker *sw = &srv->workers[i];
+
+                requests += counter_get(&sw->requests);
+                errors += counter_get(&sw->errors);
+                for (b = 0; b < LATENCY_BUCKETS; b++)
+                        hist[b] += counter_get(&sw->latency[b]);
+        }
+
+        for (b = 0; b < LATENCY_BUCKETS; b++)
+                total += hist[b];
+
+        snprintf(buf, sizeof(buf),
+                 "{\"requests\":%" PRIu64 ",\"errors\":%" PRIu64
+                 ",\"workers\":%zu,\"p50_us\":%.1f,\"p99_us\":%.1f"
+                 ",\"p999_us\":%.1f}",
+                 requests, errors, srv->nr_workers,
+                 total ? latency_percentile(hist, total, 0.5) : 0.0,
+                 total ? latency_percentile(hist, total, 0.99) : 0.0,
+                 total ? latency_percentile(hist, total, 0.999) : 0.0);
+        cstring_addstr(out, buf);
+}
+
+/* Read exactly `len` bytes. Returns 1 on success, 0 on end of file before
+ * any data and -1 on errors or a short read.
+ */
+static int read_full(int fd, void *buf, size_t len)
+{
+        size_t done = 0;
+
+        while (done < len) {
+                ssize_t n = read(fd, (char *)buf + done, len - done);
+
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                if (n == 0)
+                        return done ? -1 : 0;
+                done += n;
+        }
+
+        return 1;
+}
+
+/* Read a request of `len` bytes into `in`, which only grows as the data
+ * arrives, not by the length the client announced. The whole request must
+ * arrive within SERVER_TIMEOUT. Returns 0 on success and -1 otherwise.
+ */
+static int read_request(int fd, cstring *in, size_t len)
+{
+        uint64_t deadline = now_ns() + SERVER_TIMEOUT * 1000000000ULL;
+
+        cstring_setlen(in, 0);
+        while (in->len < len) {
+                size_t want = len - in->len;
+                ssize_t n;
+
+                if (want > SERVER_READ_CHUNK)
+                        want = SERVER_READ_CHUNK;
+                if (cstring_available(in) < want)
+                        cstring_grow(in, want);
+
+                n = read(fd, in->buf + in->len, want);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                if (n == 0 || now_ns() > deadline)
+                        return -1;
+                in->len += n;
+        }
+        cstring_setlen(in, in->len);
+
+        return 0;
+}
+
+static int write_full(int fd, struct iovec *iov, int iovcnt)
+{
+        while (iovcnt > 0) {
+                ssize_t n = writev(fd, iov, iovcnt);
+
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+
+                while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+                        n -= iov->iov_len;
+                        iov++;
+                        iovcnt--;
+                }
+                if (iovcnt > 0) {
+                        iov->iov_base = (char *)iov->iov_base + n;
+                        iov->iov_len -= n;
+                }
+        }
+
+        return 0;
+}
+
+static int send_frame(int fd, uint32_t *header, int nr_header,
+                      const char *body, size_t len)
+{
+        struct iovec iov[2];
+        int i;
+
+        for (i = 0; i < nr_header; i++)
+                header[i] = htonl(header[i]);
+
+        iov[0].iov_base = header;
+        iov[0].iov_len = nr_header * sizeof(uint32_t);
+        iov[1].iov_base = (void *)(uintptr_t)body;
+        iov[1].iov_len = len;
+
+        return write_full(fd, iov, len ? 2 : 1);
+}
+
+static int send_response(int fd, uint32_t status, const char *body,
+                         size_t len)
+{
+        uint32_t header[2] = { status, len };
+
+        return send_frame(fd, header, 2, body, len);
+}
+
+static void serve_connection(struct server_worker *sw, int fd)
+{
+        uint32_t len;
+        uint64_t start;
+        int ret;
+
+        while (read_full(fd, &len, sizeof(len)) == 1) {
+                len = ntohl(len);
+
+                cstring_setlen(&sw->out, 0);
+
+                if (len == 0) {
+                        server_stats(sw->srv, &sw->out);
+                        if (send_response(fd, SERVER_OK, sw->out.buf,
+                                          sw->out.len) < 0)
+                                break;
+                        continue;
+                }
+
+                if (len > SERVER_MAX_REQUEST) {
+                        counter_inc(&sw->errors);
+                        send_response(fd, SERVER_ETOOBIG,
+                                      "request too large", 17);
+                        break;
+                }
+
+                if (read_request(fd, &sw->in, len) < 0)
+                        break;
+
+                start = now_ns();
+
+                json_writer_init_cstring(&sw->w, &sw->out);
+                ret = converter_convert_buffer(&sw->conv, sw->in.buf, len,
+                                               "<request>", &sw->w);
+                json_writer_flush(&sw->w);
+
+                if (ret < 0) {
+                        counter_inc(&sw->errors);
+                        ret = send_response(fd, SERVER_EINVAL,
+                                            "not well formed", 15);
+                } else if (ret == CONVERT_INVALID) {
+                        counter_inc(&sw->errors);
+                        ret = send_response(fd, SERVER_ENOTVALID,
+                                            "fails to validate", 17);
+                } else {
+                        ret = send_response(fd, SERVER_OK, sw->out.buf,
+                                            sw->out.len);
+                }
+
+                counter_inc(&sw->requests);
+                counter_inc(&sw->latency[latency_bucket(now_ns() - start)]);
+
+                if (ret < 0)
+                        break;
+        }
+}
+
+/* A client that stops sending, or stops reading its responses, would
+ * hold on to the worker serving it.
+ */
+static void set_timeouts(int fd)
+{
+        struct timeval tv = { .tv_sec = SERVER_TIMEOUT };
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static void *server_worker_main(void *data)
+{
+        struct server_worker *sw = data;
+        int fd;
+
+        for (;;) {
+                fd = accept(sw->srv->fd, NULL, NULL);
+                if (fd < 0) {
+                        if (errno != EINTR && errno != ECONNABORTED)
+                                perror("accept: ");
+                        continue;
+                }
+
+                set_timeouts(fd);
+                serve_connection(sw, fd);
+                close(fd);
+        }
+
+        return NULL;
+}
+
+static int unix_socket(const char *path, struct sockaddr_un *addr)
+{
+        int fd;
+
+        if (strlen(path) >= sizeof(addr->sun_path)) {
+                fprintf(stderr, "%s: socket path too long\n", path);
+                return -1;
+        }
+
+        memset(addr, 0, sizeof(struct sockaddr_un));
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+                perror("socket: ");
+
+        return fd;
+}
+
+/* Read a whole input file, `-` being stdin */
+static int read_input(const char *path, cstring *buf)
+{
+        char chunk[65536];
+        ssize_t n;
+        int fd;
+
+        if (strcmp(path, "-") == 0)
+                fd = STDIN_FILENO;
+        else if ((fd = open(path, O_RDONLY)) < 0)
+                return -1;
+
+        cstring_setlen(buf, 0);
+        while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        break;
+                }
+                cstring_add(buf, chunk, n);
+        }
+
+        if (fd != STDIN_FILENO)
+                close(fd);
+
+        return n < 0 ? -1 : 0;
+}
+
+/* Send one request and read its response into `out` */
+static int client_request(int fd, const char *xml, size_t len,
+                          uint32_t *status, cstring *out)
+{
+        uint32_t header[2];
+
+        header[0] = len;
+        if (send_frame(fd, header, 1, xml, len) < 0)
+                return -1;
+
+        if (read_full(fd, header, sizeof(header)) != 1)
+                return -1;
+
+        *status = ntohl(header[0]);
+        len = ntohl(header[1]);
+
+        cstring_setlen(out, 0);
+        cstring_grow(out, len);
+        if (len && read_full(fd, out->buf, len) != 1)
+                return -1;
+        cstring_setlen(out, len);
+
+        return 0;
+}
+
+/*
+ * Public Functions
+ */
+
+int server_run(struct converter *conv, const char *path, size_t jobs)
+{
+        struct sockaddr_un addr;
+        struct server srv;
+        pthread_t thread;
+        size_t i;
+        int ret;
+
+        srv.fd = unix_socket(path, &addr);
+        if (srv.fd < 0)
+                return -1;
+
+        unlink(path);
+        if (bind(srv.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(srv.fd, SOMAXCONN) < 0) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                close(srv.fd);
+                return -1;
+        }
+
+        /* A client going away shows up as a failed write */
+        signal(SIGPIPE, SIG_IGN);
+
+        if (jobs < 1)
+                jobs = 1;
+
+        srv.nr_workers = jobs;
+        srv.workers = xcalloc(jobs, sizeof(struct server_worker));
+        for (i = 0; i < jobs; i++) {
+                struct server_worker *sw = &srv.workers[i];
+
+                sw->srv = &srv;
+                if (converter_clone(&sw->conv, conv) < 0) {
+                        fprintf(stderr, "Failed to initialise the converter\n");
+                        exit(EXIT_FAILURE);
+                }
+                sw->conv.xml_options &= ~XML_PARSE_HUGE;
+                sw->conv.xml_options |= XML_PARSE_NOERROR | XML_PARSE_NOWARNING;
+                sw->conv.verror = NULL;
+                cstring_init(&sw->in, 0);
+                cstring_init(&sw->out, 0);
+        }
+
+        /* Every worker accepts connections itself, the first one on this
+         * thread.
+         */
+        for (i = 1; i < jobs; i++) {
+                ret = pthread_create(&thread, NULL, server_worker_main,
+                                     &srv.workers[i]);
+                if (ret) {
+                        fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+                        exit(EXIT_FAILURE);
+                }
+                pthread_detach(thread);
+        }
+
+        server_worker_main(&srv.workers[0]);
+
+        return 0;
+}
+
+int server_client(const char *path, char **files, size_t nr,
+                  struct json_writer *w)
+{
+        struct sockaddr_un addr;
+        cstring in, out;
+        uint32_t status;
+        size_t i;
+        int fd, failed = 0;
+
+        fd = unix_socket(path, &addr);
+        if (fd < 0)
+                return -1;
+
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                close(fd);
+                return -1;
+        }
+
+        cstring_init(&in, 0);
+        cstring_init(&out, 0);
+
+        if (nr == 0) {
+                if (client_request(fd, NULL, 0, &status, &out) < 0) {
+                        failed = 1;
+                } else {
+                        json_writer_add(w, out.buf, out.len);
+                        json_writer_addch(w, '\n');
+                }
+        }
+
+        for (i = 0; i < nr; i++) {
+                if (read_input(files[i], &in) < 0) {
+                        fprintf(stderr, "%s: %s\n", files[i], strerror(errno));
+                        failed = 1;
+                        continue;
+                }
+
+                if (in.len == 0 || in.len > SERVER_MAX_REQUEST) {
+                        fprintf(stderr, "%s: bad request size\n", files[i]);
+                        failed = 1;
+                        continue;
+                }
+
+                if (client_request(fd, in.buf, in.len, &status, &out) < 0) {
+                        fprintf(stderr, "%s: connection lost\n", path);
+                        failed = 1;
+                        break;
+                }
+
+                if (status != SERVER_OK) {
+                        fprintf(stderr, "%s: %.*s\n", files[i],
+                                (int)out.len, out.buf);
+                        failed = 1;
+                        continue;
+                }
+
+                json_writer_add(w, out.buf, out.len);
+        }
+
+        cstring_release(&in);
+        cstring_release(&out);
+        close(fd);
+
+        return failed ? -1 : 0;
+}
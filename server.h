@@ -0,0 +1,67 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * server - convert documents sent over a Unix domain socket.
+ */
+
+#ifndef XML2JSON_SERVER_H
+#define XML2JSON_SERVER_H
+
+#include "converter.h"
+#include "json.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Protocol:
+ * A connection carries any number of requests, each answered in turn.
+ * All integers are 32 bit, in network byte order.
+ *
+ *   request:  length, followed by `length` bytes of XML
+ *   response: status, length, followed by `length` bytes of JSON when
+ *             status is SERVER_OK, or of an error message otherwise
+ *
+ * A request of length 0 asks for the server's statistics, which are sent
+ * back as a JSON object.
+ */
+#define SERVER_OK               0
+#define SERVER_EINVAL           1       /* the document is not well formed */
+#define SERVER_ETOOBIG          2       /* the request exceeds the limit */
+#define SERVER_ENOTVALID        3       /* it fails to validate */
+
+/* Largest request accepted, the connection is closed after a larger one */
+#define SERVER_MAX_REQUEST      (256 * 1024 * 1024)
+
+/* Seconds a request may take to arrive, and a connection may stay idle
+ * or leave a response unread, before it is closed.
+ */
+#define SERVER_TIMEOUT          30
+
+/* server_run():
+ * Listen on the Unix domain socket `path` and serve requests on `jobs`
+ * threads, each with a clone of `conv`. A stale socket at `path` is
+ * removed first. Requests come from other processes, so the clones parse
+ * them within libxml2's limits, XML_PARSE_HUGE is dropped from `conv`'s
+ * options. Parse and validation errors are only sent back to the client,
+ * nothing is printed for them. Only returns if the socket could not be set
+ * up, with -1.
+ */
+extern int server_run(struct converter *conv, const char *path, size_t jobs);
+
+/* server_client():
+ * Send each of `files` as a request to the server at `path` and write the
+ * responses to `w`, one line each. With no files, the server's statistics
+ * are written instead. Returns 0 if every request succeeded, -1 otherwise.
+ */
+extern int server_client(const char *path, char **files, size_t nr,
+                         struct json_writer *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_SERVER_H */
@@ -0,0 +1,165 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * bench-numfmt - numfmt_double() against sprintf("%.16g").
+ *
+ * Writes sets of doubles the way json.c used to, with sprintf("%.16g"),
+ * and with numfmt_double(), and prints the nanoseconds per number. Only
+ * numbers made from a double, with json_num_obj(), go through numfmt:
+ * xml2json writes the numbers it finds in documents as their lexemes.
+ */
+
+#include "numfmt.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NR_VALUES 1000000
+#define NR_ROUNDS 3
+
+static uint64_t rng_state = UINT64_C(0x9e3779b97f4a7c15);
+
+static uint64_t rng(void)
+{
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+
+        return rng_state;
+}
+
+/* A double in [0, 1) */
+static double rng_unit(void)
+{
+        return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_integers(double *v, size_t nr)
+{
+        size_t i;
+
+        for (i = 0; i < nr; i++)
+                v[i] = (double)(rng() % 1000000);
+}
+
+static void fill_prices(double *v, size_t nr)
+{
+        size_t i;
+
+        for (i = 0; i < nr; i++)
+                v[i] = (double)(rng() % 10000000) / 100;
+}
+
+static void fill_uniform(double *v, size_t nr)
+{
+        size_t i;
+
+        for (i = 0; i < nr; i++)
+                v[i] = rng_unit() * 1e6;
+}
+
+static void fill_bits(double *v, size_t nr)
+{
+        size_t i;
+
+        for (i = 0; i < nr; i++) {
+                uint64_t bits;
+
+                /* Finite doubles of any exponent */
+                do {
+                        bits = rng();
+                } while (((bits >> 52) & 0x7ff) == 0x7ff);
+                memcpy(&v[i], &bits, sizeof(bits));
+        }
+}
+
+/* Best of NR_ROUNDS, in nanoseconds per value. The lengths are summed so
+ * the work is not optimised away.
+ */
+static double time_sprintf(const double *v, size_t nr, size_t *total)
+{
+        char buf[64];
+        double best = 0;
+        int r;
+
+        for (r = 0; r < NR_ROUNDS; r++) {
+                double t = now();
+                size_t i;
+
+                for (i = 0; i < nr; i++)
+                        *total += sprintf(buf, "%.16g", v[i]);
+                t = now() - t;
+                if (r == 0 || t < best)
+                        best = t;
+        }
+
+        return best * 1e9 / nr;
+}
+
+static double time_numfmt(const double *v, size_t nr, size_t *total)
+{
+        char buf[NUMFMT_MAX];
+        double best = 0;
+        int r;
+
+        for (r = 0; r < NR_ROUNDS; r++) {
+                double t = now();
+                size_t i;
+
+                for (i = 0; i < nr; i++)
+                        *total += numfmt_double(buf, v[i]);
+                t = now() - t;
+                if (r == 0 || t < best)
+                        best = t;
+        }
+
+        return best * 1e9 / nr;
+}
+
+int main(void)
+{
+        static const struct {
+                const char *name;
+                void (*fill)(double *v, size_t nr);
+        } sets[] = {
+                { "integers < 1e6", fill_integers },
+                { "prices, 2 decimals", fill_prices },
+                { "random in [0,1e6)", fill_uniform },
+                { "random bit patterns", fill_bits },
+        };
+        double *v = malloc(NR_VALUES * sizeof(double));
+        size_t total = 0;
+        size_t i;
+
+        if (v == NULL)
+                return EXIT_FAILURE;
+
+        printf("bench-numfmt: %d values per set, ns per number\n",
+               NR_VALUES);
+        printf("  %-22s %8s %8s\n", "set", "sprintf", "numfmt");
+        for (i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+                double ts, tn;
+
+                sets[i].fill(v, NR_VALUES);
+                ts = time_sprintf(v, NR_VALUES, &total);
+                tn = time_numfmt(v, NR_VALUES, &total);
+                printf("  %-22s %8.0f %8.0f  x%.1f\n", sets[i].name, ts, tn,
+                       ts / tn);
+        }
+
+        free(v);
+
+        return total ? EXIT_SUCCESS : EXIT_FAILURE;
+}
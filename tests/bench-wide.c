@@ -0,0 +1,176 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * bench-wide - grouping the children of a wide element.
+ *
+ * A parent with 100k children under one name, 1000 names or all distinct
+ * names: the children are grouped by name with the hash table, put then
+ * walked key by key with htable_get_next(), and the document is converted
+ * with each backend. Parsing is not timed.
+ */
+
+#include "converter.h"
+#include "cstring.h"
+#include "htable.h"
+#include "json.h"
+#include "util.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <libxml/parser.h>
+
+#define NR_CHILDREN 100000
+#define NR_ROUNDS 3
+
+struct child {
+        struct htable_entry entry;
+        const xmlChar *name;
+};
+
+static int child_cmp(const void *data, const void *entry1,
+                     const void *entry2, const void *kdata)
+{
+        const struct child *a = entry1, *b = entry2;
+
+        return strcmp((const char *)a->name, (const char *)b->name);
+}
+
+static int null_sink(void *data, const struct iovec *iov, int iovcnt)
+{
+        return 0;
+}
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A root with NR_CHILDREN children under `distinct` names */
+static xmlDocPtr wide_document(unsigned int distinct)
+{
+        xmlDocPtr doc;
+        cstring buf;
+        unsigned int i;
+        char item[64];
+
+        cstring_init(&buf, 0);
+        cstring_addstr(&buf, "<root>");
+        for (i = 0; i < NR_CHILDREN; i++) {
+                snprintf(item, sizeof(item), "<n%u>%u</n%u>",
+                         i % distinct, i, i % distinct);
+                cstring_addstr(&buf, item);
+        }
+        cstring_addstr(&buf, "</root>");
+
+        doc = xmlReadMemory(buf.buf, buf.len, "wide.xml", NULL,
+                            XML_PARSE_COMPACT);
+        cstring_release(&buf);
+
+        return doc;
+}
+
+/* Group the children of the root of `doc` by name, returns the seconds
+ * taken.
+ */
+static double time_htable(xmlDocPtr doc, struct child *children)
+{
+        struct htable_iter iter;
+        struct htable ht;
+        struct child *c;
+        xmlNodePtr n;
+        size_t nr = 0, seen = 0;
+        double t = now();
+
+        htable_init(&ht, child_cmp, NULL, 0);
+        for (n = xmlDocGetRootElement(doc)->children; n; n = n->next) {
+                c = &children[nr++];
+                c->name = n->name;
+                htable_entry_init(c, bufhash(n->name,
+                                             strlen((const char *)n->name)));
+                htable_put(&ht, c);
+        }
+
+        htable_iter_init_ordered(&ht, &iter);
+        while ((c = htable_iter_next_ordered(&iter))) {
+                const void *e;
+
+                for (e = c; e; e = htable_get_next(&ht, e))
+                        seen++;
+        }
+        htable_free(&ht, 0);
+
+        t = now() - t;
+        if (seen != nr)
+                fprintf(stderr, "bench-wide: grouped %zu of %zu\n", seen, nr);
+
+        return t;
+}
+
+static double time_convert(struct converter *conv, xmlDocPtr doc,
+                           enum convert_backend backend,
+                           struct json_writer *w)
+{
+        double t = now();
+
+        conv->backend = backend;
+        converter_convert_doc(conv, doc, w);
+
+        return now() - t;
+}
+
+int main(void)
+{
+        static const unsigned int distinct[] = { 1, 1000, NR_CHILDREN };
+        struct child *children = xcalloc(NR_CHILDREN, sizeof(struct child));
+        struct json_writer *w = xmalloc(sizeof(struct json_writer));
+        struct converter conv;
+        size_t i;
+
+        if (converter_init(&conv, NULL, NULL, XML_PARSE_COMPACT) < 0)
+                return EXIT_FAILURE;
+        json_writer_init(w, null_sink, NULL);
+
+        printf("bench-wide: one parent, %d children, best of %d, seconds\n",
+               NR_CHILDREN, NR_ROUNDS);
+        printf("  %-8s %9s %9s %9s %9s\n", "names", "htable", "emit", "tree",
+               "tape");
+        for (i = 0; i < ARRAY_SIZE(distinct); i++) {
+                static const enum convert_backend backends[] = {
+                        BACKEND_EMIT, BACKEND_TREE, BACKEND_TAPE,
+                };
+                xmlDocPtr doc = wide_document(distinct[i]);
+                double best[4] = { 0, 0, 0, 0 };
+                size_t b;
+                int r;
+
+                if (doc == NULL)
+                        return EXIT_FAILURE;
+
+                for (r = 0; r < NR_ROUNDS; r++) {
+                        double t = time_htable(doc, children);
+
+                        if (r == 0 || t < best[0])
+                                best[0] = t;
+                        for (b = 0; b < ARRAY_SIZE(backends); b++) {
+                                t = time_convert(&conv, doc, backends[b], w);
+                                if (r == 0 || t < best[b + 1])
+                                        best[b + 1] = t;
+                        }
+                }
+
+                printf("  %-8u %9.4f %9.4f %9.4f %9.4f\n", distinct[i],
+                       best[0], best[1], best[2], best[3]);
+                xmlFreeDoc(doc);
+        }
+
+        converter_release(&conv);
+        free(w);
+        free(children);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * test-alloc - heap allocations made while converting a parsed document.
+ *
+ * malloc() and friends are interposed to count the allocations made by
+ * converter_convert_doc() alone, without those of the parser. The counts
+ * and times are printed for each backend, and checked against a bound so
+ * that per element allocations, which sibling grouping and attribute
+ * names used to make, do not come back.
+ */
+
+#include "test.h"
+
+#include "converter.h"
+#include "cstring.h"
+#include "json.h"
+#include "util.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <libxml/parser.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/* Once its buffers are warm, the converter allocates for the document as
+ * a whole, not for its elements.
+ */
+#define ELEMENTS_PER_ALLOC 10000
+
+static unsigned long nr_allocs;
+
+void *malloc(size_t size)
+{
+        nr_allocs++;
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+        nr_allocs++;
+        return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+        nr_allocs++;
+        return __libc_realloc(ptr, size);
+}
+
+static int null_sink(void *data, const struct iovec *iov, int iovcnt)
+{
+        return 0;
+}
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long count_elements(xmlNodePtr node)
+{
+        unsigned long n = 0;
+
+        for (; node; node = node->next) {
+                if (node->type == XML_ELEMENT_NODE)
+                        n += 1 + count_elements(node->children);
+        }
+
+        return n;
+}
+
+/* A root with `nr` children under `distinct` names, each with a few
+ * children of its own.
+ */
+static xmlDocPtr wide_document(unsigned int nr, unsigned int distinct)
+{
+        xmlDocPtr doc;
+        cstring buf;
+        unsigned int i;
+        char item[128];
+
+        cstring_init(&buf, 0);
+        cstring_addstr(&buf, "<root>");
+        for (i = 0; i < nr; i++) {
+                snprintf(item, sizeof(item),
+                         "<n%u a=\"%u\"><x>%u</x><y>y</y><y>z</y></n%u>",
+                         i % distinct, i, i, i % distinct);
+                cstring_addstr(&buf, item);
+        }
+        cstring_addstr(&buf, "</root>");
+
+        doc = xmlReadMemory(buf.buf, buf.len, "wide.xml", NULL,
+                            XML_PARSE_COMPACT);
+        cstring_release(&buf);
+
+        return doc;
+}
+
+/* Convert `doc` twice with `backend`, the first time to warm up the
+ * converter's reusable buffers, and check the second conversion makes
+ * at most one allocation per ELEMENTS_PER_ALLOC elements.
+ */
+static void check_doc(struct converter *conv, const char *name, xmlDocPtr doc,
+                      enum convert_backend backend)
+{
+        static const char *const backends[] = { "emit", "tree", "tape" };
+        unsigned long elements, before, allocs;
+        struct json_writer *w;
+        double t;
+
+        CHECK(doc != NULL);
+        if (doc == NULL)
+                return;
+
+        elements = count_elements(xmlDocGetRootElement(doc));
+        w = malloc(sizeof(struct json_writer));
+        json_writer_init(w, null_sink, NULL);
+
+        conv->backend = backend;
+        converter_convert_doc(conv, doc, w);
+
+        before = nr_allocs;
+        t = now();
+        converter_convert_doc(conv, doc, w);
+        t = now() - t;
+        allocs = nr_allocs - before;
+
+        printf("test-alloc: %-10s %-4s %7lu elements %7lu allocations "
+               "%.3f s\n", name, backends[backend], elements, allocs, t);
+        CHECK(allocs <= elements / ELEMENTS_PER_ALLOC);
+
+        free(w);
+}
+
+int main(void)
+{
+        static const enum convert_backend backends[] = {
+                BACKEND_EMIT, BACKEND_TREE, BACKEND_TAPE,
+        };
+        struct converter conv;
+        xmlDocPtr mondial, wide;
+        size_t i;
+
+        CHECK(converter_init(&conv, NULL, NULL, XML_PARSE_COMPACT) == 0);
+
+        mondial = xmlReadFile("data/mondial-3.0.xml", NULL,
+                              XML_PARSE_COMPACT);
+        wide = wide_document(100000, 1000);
+
+        for (i = 0; i < ARRAY_SIZE(backends); i++) {
+                check_doc(&conv, "mondial", mondial, backends[i]);
+                check_doc(&conv, "wide", wide, backends[i]);
+        }
+
+        xmlFreeDoc(mondial);
+        xmlFreeDoc(wide);
+        converter_release(&conv);
+
+        return test_done("test-alloc");
+}
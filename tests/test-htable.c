@@ -0,0 +1,171 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * test-htable - duplicate keys, growth, removal and iteration order of the
+ * hash table.
+ */
+
+#include "test.h"
+
+#include "htable.h"
+
+#include <string.h>
+
+#define NR_ITEMS 100000
+#define NR_KEYS 1000
+
+struct item {
+        struct htable_entry entry;
+        char key[16];
+        unsigned int id;        /* the number in `key` */
+        unsigned int seq;       /* put order */
+};
+
+static int item_cmp(const void *data, const void *entry1,
+                    const void *entry2, const void *kdata)
+{
+        const struct item *a = entry1, *b = entry2;
+
+        return strcmp(a->key, b->key);
+}
+
+static void item_init(struct item *it, unsigned int key, unsigned int seq)
+{
+        snprintf(it->key, sizeof(it->key), "k%u", key);
+        it->id = key;
+        it->seq = seq;
+        htable_entry_init(it, bufhash(it->key, strlen(it->key)));
+}
+
+static struct item *get(struct htable *ht, unsigned int key)
+{
+        struct item k;
+
+        item_init(&k, key, 0);
+        return htable_get(ht, &k, NULL);
+}
+
+static struct item *remove_key(struct htable *ht, unsigned int key)
+{
+        struct item k;
+
+        item_init(&k, key, 0);
+        return htable_remove(ht, &k, NULL);
+}
+
+/* Walk the entries of `key` with get/get_next, checking they come in put
+ * order. Returns how many there are.
+ */
+static unsigned int walk_key(struct htable *ht, unsigned int key)
+{
+        const struct item *it = get(ht, key);
+        unsigned int n = 0, seq = 0;
+
+        for (; it; it = htable_get_next(ht, it)) {
+                CHECK(it->id == key);
+                CHECK(n == 0 || it->seq > seq);
+                seq = it->seq;
+                n++;
+        }
+
+        return n;
+}
+
+/* Check the ordered iterator gives each key in `keys` once, in order,
+ * with its first entry.
+ */
+static void check_ordered(struct htable *ht, const unsigned int *keys,
+                          unsigned int nr)
+{
+        struct htable_iter iter;
+        struct item *it;
+        unsigned int i = 0;
+
+        htable_iter_init_ordered(ht, &iter);
+        while ((it = htable_iter_next_ordered(&iter))) {
+                CHECK(i < nr);
+                if (i >= nr)
+                        break;
+                CHECK(it == get(ht, keys[i]));
+                i++;
+        }
+        CHECK(i == nr);
+}
+
+int main(void)
+{
+        struct item *items = calloc(NR_ITEMS, sizeof(struct item));
+        unsigned int keys[NR_KEYS];
+        struct htable_iter iter;
+        struct htable ht;
+        struct item *it, *first;
+        unsigned int i, n;
+
+        htable_init(&ht, item_cmp, NULL, 0);
+
+        /* Keys are first put in reverse order, duplicates follow */
+        for (i = 0; i < NR_ITEMS; i++) {
+                item_init(&items[i], NR_KEYS - 1 - i % NR_KEYS, i);
+                htable_put(&ht, &items[i]);
+        }
+        for (i = 0; i < NR_KEYS; i++)
+                keys[i] = NR_KEYS - 1 - i;
+
+        CHECK(ht.count == NR_ITEMS);
+        CHECK(ht.size > NR_ITEMS);
+        CHECK(get(&ht, NR_KEYS) == NULL);
+
+        for (i = 0; i < NR_KEYS; i++) {
+                first = get(&ht, i);
+                CHECK(first != NULL && first->entry.count ==
+                      NR_ITEMS / NR_KEYS);
+                CHECK(walk_key(&ht, i) == NR_ITEMS / NR_KEYS);
+        }
+        check_ordered(&ht, keys, NR_KEYS);
+
+        /* The plain iterator sees every entry once */
+        n = 0;
+        htable_iter_init(&ht, &iter);
+        while (htable_iter_next(&iter))
+                n++;
+        CHECK(n == NR_ITEMS);
+
+        /* Removing the first entry of a key makes the next one first,
+         * in the same place in the key order.
+         */
+        first = get(&ht, 5);
+        it = remove_key(&ht, 5);
+        CHECK(it == first);
+        first = get(&ht, 5);
+        CHECK(first != NULL && first != it &&
+              first->entry.count == NR_ITEMS / NR_KEYS - 1);
+        CHECK(walk_key(&ht, 5) == NR_ITEMS / NR_KEYS - 1);
+        check_ordered(&ht, keys, NR_KEYS);
+
+        /* Removing all the entries of a key drops it from the order */
+        while (remove_key(&ht, 7))
+                ;
+        CHECK(get(&ht, 7) == NULL);
+        memmove(&keys[NR_KEYS - 1 - 7], &keys[NR_KEYS - 7],
+                7 * sizeof(unsigned int));
+        check_ordered(&ht, keys, NR_KEYS - 1);
+        CHECK(remove_key(&ht, 7) == NULL);
+        CHECK(ht.count == NR_ITEMS - NR_ITEMS / NR_KEYS - 1);
+
+        /* Shrinking keeps the runs of duplicates in order */
+        for (i = 100; i < NR_KEYS; i++) {
+                while (remove_key(&ht, i))
+                        ;
+        }
+        CHECK(ht.size < NR_ITEMS);
+        for (i = 0; i < 100; i++) {
+                if (i == 7)
+                        continue;
+                CHECK(walk_key(&ht, i) == NR_ITEMS / NR_KEYS - (i == 5));
+        }
+
+        htable_free(&ht, 0);
+        free(items);
+
+        return test_done("test-htable");
+}
@@ -0,0 +1,374 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * test-kernels - the SSE2 and AVX2 scanners against the scalar ones.
+ *
+ * White space normalisation and JSON escaping run every kernel the CPU
+ * supports, and scalar_classify() runs its SSE2 code, over random text of
+ * random lengths at random offsets. Every text is also checked ending
+ * right before a page that can't be read, and the white space is written
+ * ending right before one that can't be written, so a kernel that reads
+ * or writes past the end of its buffers crashes. Copies allocated to the
+ * exact size let AddressSanitizer catch the same reads within a page.
+ */
+
+#include "test.h"
+
+#include "jsonescape.h"
+#include "scalar.h"
+#include "util.h"
+#include "whitespace.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define NR_ROUNDS 20000
+#define MAX_LEN 300
+#define MAX_OFFSET 64
+
+static uint64_t rng_state = UINT64_C(0x9e3779b97f4a7c15);
+
+static uint64_t rng(void)
+{
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+
+        return rng_state;
+}
+
+/* A random length, mostly short ones, where strings are */
+static size_t random_len(void)
+{
+        return rng() % (rng() & 1 ? 40 : MAX_LEN + 1);
+}
+
+/* Fill `buf` with text in which one byte in `one_in` is from `rare` and
+ * the others from `common`.
+ */
+static void fill(char *buf, size_t len, const char *common, const char *rare,
+                 unsigned int one_in)
+{
+        size_t nr_common = strlen(common), nr_rare = strlen(rare);
+        size_t i;
+
+        for (i = 0; i < len; i++) {
+                if (rng() % one_in == 0)
+                        buf[i] = rare[rng() % nr_rare];
+                else
+                        buf[i] = common[rng() % nr_common];
+        }
+}
+
+/* A copy of the `len` bytes at `s` in a buffer of just that size */
+static char *exact_copy(const char *s, size_t len)
+{
+        char *copy = xmalloc(len ? len : 1);
+
+        memcpy(copy, s, len);
+
+        return copy;
+}
+
+/* A page followed by one that can't be accessed. Returns the end of the
+ * first one.
+ */
+static char *guarded_page(void)
+{
+        long size = sysconf(_SC_PAGESIZE);
+        char *p;
+
+        p = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+                perror("mmap");
+                exit(EXIT_FAILURE);
+        }
+        if (mprotect(p + size, size, PROT_NONE) < 0) {
+                perror("mprotect");
+                exit(EXIT_FAILURE);
+        }
+
+        return p + size;
+}
+
+/*
+ * White space
+ */
+
+static const char *const ws_modes[] = { "strip", "trim", "collapse",
+                                        "preserve" };
+
+static void check_ws(const char *isa, const char *src, size_t len,
+                     char *dst)
+{
+        char ref[MAX_LEN];
+        size_t i, n, ref_n;
+        int blank, ref_blank;
+
+        for (i = 0; i < ARRAY_SIZE(ws_modes); i++) {
+                enum ws_mode mode;
+
+                ws_mode_parse(ws_modes[i], &mode);
+
+                ws_use_kernel("scalar");
+                ref_n = ws_normalize(ref, src, len, mode);
+                ref_blank = ws_is_blank(src, len);
+
+                ws_use_kernel(isa);
+                n = ws_normalize(dst, src, len, mode);
+                blank = ws_is_blank(src, len);
+
+                if (n != ref_n || memcmp(dst, ref, n) != 0 ||
+                    blank != ref_blank) {
+                        fprintf(stderr, "test-kernels: %s %s of %zu bytes "
+                                "differs\n", isa, ws_modes[i], len);
+                        CHECK(n == ref_n && memcmp(dst, ref, n) == 0);
+                        CHECK(blank == ref_blank);
+                }
+        }
+}
+
+/* Text with white space that is rare, common, or all there is */
+static void fill_ws(char *buf, size_t len)
+{
+        static const unsigned int one_in[] = { 1, 2, 8, 64 };
+
+        fill(buf, len, "abcdefgh<&;", " \t\n\r",
+             one_in[rng() % ARRAY_SIZE(one_in)]);
+}
+
+static void test_ws(const char *isa, char *src_end, char *dst_end)
+{
+        char *buf = xmalloc(MAX_LEN + MAX_OFFSET);
+        char *dst = xmalloc(MAX_LEN + MAX_OFFSET);
+        char *exact, *out;
+        size_t len, off;
+        int i;
+
+        for (i = 0; i < NR_ROUNDS; i++) {
+                len = random_len();
+                off = rng() % MAX_OFFSET;
+                fill_ws(buf + off, len);
+                check_ws(isa, buf + off, len, dst + rng() % MAX_OFFSET);
+
+                exact = exact_copy(buf + off, len);
+                out = xmalloc(len ? len : 1);
+                check_ws(isa, exact, len, out);
+                free(exact);
+                free(out);
+        }
+
+        for (len = 0; len <= MAX_LEN; len++) {
+                fill_ws(src_end - len, len);
+                check_ws(isa, src_end - len, len, dst_end - len);
+        }
+
+        free(buf);
+        free(dst);
+}
+
+/*
+ * JSON escaping
+ */
+
+static void check_escape(const char *isa, const char *src, size_t len,
+                         char *dst)
+{
+        size_t ref_find, ref_copy, find, copy;
+        char ref[MAX_LEN + JSON_ESCAPE_PAD];
+
+        json_escape_use_kernel("scalar");
+        ref_find = json_escape_find(src, len);
+        ref_copy = json_escape_copy(ref, src, len);
+
+        json_escape_use_kernel(isa);
+        find = json_escape_find(src, len);
+        copy = json_escape_copy(dst, src, len);
+
+        CHECK(ref_find == ref_copy);
+        if (find != ref_find || copy != ref_copy ||
+            memcmp(dst, src, copy) != 0) {
+                fprintf(stderr, "test-kernels: %s escaping of %zu bytes "
+                        "differs\n", isa, len);
+                CHECK(find == ref_find);
+                CHECK(copy == ref_copy && memcmp(dst, src, copy) == 0);
+        }
+}
+
+/* Text with bytes to escape that are rare, or not so rare, among UTF-8
+ * and ASCII bytes which are not escaped.
+ */
+static void fill_escape(char *buf, size_t len)
+{
+        static const unsigned int one_in[] = { 4, 32, 512 };
+
+        fill(buf, len, "abc <>&\x7f\x80\xc3\xa9\xff", "\"\\\x01\n\x1f",
+             one_in[rng() % ARRAY_SIZE(one_in)]);
+}
+
+static void test_escape(const char *isa, char *src_end)
+{
+        char *buf = xmalloc(MAX_LEN + MAX_OFFSET);
+        char *dst = xmalloc(MAX_LEN + MAX_OFFSET + JSON_ESCAPE_PAD);
+        char *exact, *out;
+        size_t len, off;
+        int i;
+
+        for (i = 0; i < NR_ROUNDS; i++) {
+                len = random_len();
+                off = rng() % MAX_OFFSET;
+                fill_escape(buf + off, len);
+                check_escape(isa, buf + off, len, dst + rng() % MAX_OFFSET);
+
+                exact = exact_copy(buf + off, len);
+                out = xmalloc(len + JSON_ESCAPE_PAD);
+                check_escape(isa, exact, len, out);
+                free(exact);
+                free(out);
+        }
+
+        for (len = 0; len <= MAX_LEN; len++) {
+                fill_escape(src_end - len, len);
+                check_escape(isa, src_end - len, len, dst);
+        }
+
+        free(buf);
+        free(dst);
+}
+
+/*
+ * Numbers and booleans
+ */
+
+static int is_digit(char c)
+{
+        return c >= '0' && c <= '9';
+}
+
+/* The JSON grammar, a byte at a time */
+static enum scalar_type ref_classify(const char *s, size_t len)
+{
+        size_t i = 0, start;
+
+        if ((len == 4 && memcmp(s, "true", 4) == 0) ||
+            (len == 5 && memcmp(s, "false", 5) == 0))
+                return SCALAR_BOOL;
+
+        if (i < len && s[i] == '-')
+                i++;
+        if (i < len && s[i] == '0') {
+                i++;
+        } else {
+                for (start = i; i < len && is_digit(s[i]); i++)
+                        ;
+                if (i == start)
+                        return SCALAR_STRING;
+        }
+
+        if (i < len && s[i] == '.') {
+                for (start = ++i; i < len && is_digit(s[i]); i++)
+                        ;
+                if (i == start)
+                        return SCALAR_STRING;
+        }
+
+        if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+                if (++i < len && (s[i] == '+' || s[i] == '-'))
+                        i++;
+                for (start = i; i < len && is_digit(s[i]); i++)
+                        ;
+                if (i == start)
+                        return SCALAR_STRING;
+        }
+
+        return i == len ? SCALAR_NUMBER : SCALAR_STRING;
+}
+
+/* Mostly digits with the odd sign, dot or exponent, some of them numbers;
+ * and sometimes a number with one byte changed, or a boolean.
+ */
+static size_t fill_number(char *buf, size_t max)
+{
+        static const char *const words[] = { "true", "false", "-0", "0.5e-3",
+                                             "123.456E+78", "-9e9" };
+        size_t len = rng() % (max + 1);
+
+        switch (rng() % 4) {
+        case 0:
+                snprintf(buf, max + 1, "%s", words[rng() % ARRAY_SIZE(words)]);
+                len = strlen(buf);
+                if (len && rng() & 1)
+                        buf[rng() % len] = "0-.eEx"[rng() % 6];
+                return len;
+        default:
+                fill(buf, len, "0123456789", "-+.eE", 8);
+                return len;
+        }
+}
+
+static void check_classify(const char *s, size_t len)
+{
+        enum scalar_type ref = ref_classify(s, len);
+        enum scalar_type type = scalar_classify(s, len);
+
+        if (type != ref) {
+                fprintf(stderr, "test-kernels: \"%.*s\" is classified as "
+                        "%d, not %d\n", (int)len, s, type, ref);
+                CHECK(type == ref);
+        }
+}
+
+static void test_classify(char *src_end)
+{
+        char *buf = xmalloc(MAX_LEN + MAX_OFFSET + 1);
+        char *exact;
+        size_t len, off;
+        int i;
+
+        for (i = 0; i < NR_ROUNDS; i++) {
+                off = rng() % MAX_OFFSET;
+                len = fill_number(buf + off, 40);
+                check_classify(buf + off, len);
+
+                exact = exact_copy(buf + off, len);
+                check_classify(exact, len);
+                free(exact);
+        }
+
+        for (i = 0; i < NR_ROUNDS; i++) {
+                char num[41];
+
+                len = fill_number(num, 40);
+                memcpy(src_end - len, num, len);
+                check_classify(src_end - len, len);
+        }
+
+        free(buf);
+}
+
+int main(void)
+{
+        static const char *const isas[] = { "sse2", "avx2" };
+        char *src_end = guarded_page(), *dst_end = guarded_page();
+        size_t i;
+
+        CHECK(ws_use_kernel("scalar") == 0);
+        CHECK(json_escape_use_kernel("scalar") == 0);
+        CHECK(ws_use_kernel("mmx") < 0);
+
+        for (i = 0; i < ARRAY_SIZE(isas); i++) {
+                if (ws_use_kernel(isas[i]) < 0 ||
+                    json_escape_use_kernel(isas[i]) < 0) {
+                        printf("test-kernels: no %s, skipped\n", isas[i]);
+                        continue;
+                }
+                test_ws(isas[i], src_end, dst_end);
+                test_escape(isas[i], src_end);
+        }
+        test_classify(src_end);
+
+        return test_done("test-kernels");
+}
@@ -0,0 +1,222 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * test-numfmt - numbers written by numfmt read back as the same values.
+ *
+ * Random doubles of every exponent, subnormals and integral doubles are
+ * written with numfmt_double() and read back with strtod(), which must
+ * give the same double every time. Grisu2 does not always find the
+ * shortest digits: it leaves out the boundaries between a double and its
+ * neighbours, so when the shortest digits fall right on one, as with many
+ * integers above 2^53, more are written. Only the share of such values
+ * against the shortest "%.*e" which reads back is bounded.
+ */
+
+#include "test.h"
+
+#include "numfmt.h"
+
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#define NR_VALUES 50000
+
+/* Values written with more than the fewest digits, in percent */
+#define MAX_LONGER_PERCENT 1.0
+
+static uint64_t rng_state = UINT64_C(0x9e3779b97f4a7c15);
+
+static uint64_t rng(void)
+{
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+
+        return rng_state;
+}
+
+static double from_bits(uint64_t bits)
+{
+        double d;
+
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+}
+
+static int is_digit(char c)
+{
+        return c >= '0' && c <= '9';
+}
+
+/* Skip the digits at `s[*i]`, returns how many there were */
+static size_t skip_digits(const char *s, size_t *i)
+{
+        size_t start = *i;
+
+        while (is_digit(s[*i]))
+                (*i)++;
+
+        return *i - start;
+}
+
+/* Write `d`, and check the result fits NUMFMT_MAX and is in JSON's number
+ * grammar. Returns the length, `buf` is NUL terminated.
+ */
+static size_t format(char *buf, double d)
+{
+        size_t len = numfmt_double(buf, d);
+        size_t i = 0;
+
+        CHECK(len > 0 && len < NUMFMT_MAX);
+        buf[len] = '\0';
+
+        if (buf[i] == '-')
+                i++;
+        if (buf[i] == '0')
+                i++;
+        else
+                CHECK(skip_digits(buf, &i) > 0);
+        if (buf[i] == '.') {
+                i++;
+                CHECK(skip_digits(buf, &i) > 0);
+        }
+        if (buf[i] == 'e') {
+                i++;
+                if (buf[i] == '+' || buf[i] == '-')
+                        i++;
+                CHECK(skip_digits(buf, &i) > 0);
+        }
+        CHECK(i == len);
+
+        return len;
+}
+
+/* Significant digits of a number written by numfmt or printf() */
+static int significant_digits(const char *s)
+{
+        int n = 0, zeros = 0, seen = 0;
+
+        for (; *s && *s != 'e'; s++) {
+                if (!is_digit(*s))
+                        continue;
+                if (*s == '0') {
+                        zeros += seen;
+                        continue;
+                }
+                n += zeros + 1;
+                zeros = 0;
+                seen = 1;
+        }
+
+        return n;
+}
+
+/* The fewest significant digits which read back as `d` */
+static int shortest_digits(double d)
+{
+        char buf[64];
+        int p;
+
+        for (p = 1; p < 17; p++) {
+                snprintf(buf, sizeof(buf), "%.*e", p - 1, d);
+                if (strtod(buf, NULL) == d)
+                        break;
+        }
+
+        return p;
+}
+
+static unsigned long nr_checked, nr_longer;
+
+static void check_double(double d)
+{
+        char buf[NUMFMT_MAX + 1];
+
+        format(buf, d);
+        if (strtod(buf, NULL) != d) {
+                fprintf(stderr, "%.17g written as %s\n", d, buf);
+                CHECK(strtod(buf, NULL) == d);
+                return;
+        }
+
+        nr_checked++;
+        if (significant_digits(buf) > shortest_digits(d))
+                nr_longer++;
+}
+
+static void check_special(void)
+{
+        char buf[NUMFMT_MAX + 1];
+
+        CHECK(numfmt_double(buf, NAN) == 4 && memcmp(buf, "null", 4) == 0);
+        CHECK(numfmt_double(buf, INFINITY) == 4 &&
+              memcmp(buf, "null", 4) == 0);
+        CHECK(numfmt_double(buf, -INFINITY) == 4 &&
+              memcmp(buf, "null", 4) == 0);
+
+        format(buf, 0.0);
+        CHECK(strcmp(buf, "0") == 0);
+        format(buf, -0.0);
+        CHECK(strcmp(buf, "-0") == 0);
+        format(buf, 0.1 + 0.2);
+        CHECK(strcmp(buf, "0.30000000000000004") == 0);
+        format(buf, 1e21);
+        CHECK(strcmp(buf, "1e+21") == 0);
+        format(buf, 1e-7);
+        CHECK(strcmp(buf, "1e-7") == 0);
+
+        check_double(DBL_MAX);
+        check_double(-DBL_MAX);
+        check_double(DBL_MIN);
+        check_double(from_bits(1));             /* the smallest subnormal */
+        check_double(from_bits(UINT64_C(0x000fffffffffffff)));
+        check_double(9007199254740992.0);       /* 2^53 */
+        check_double(9007199254740993.0 * 2);
+}
+
+static void check_int(int64_t v)
+{
+        char buf[NUMFMT_MAX + 1], expect[32];
+        size_t len = numfmt_int(buf, v);
+
+        buf[len] = '\0';
+        snprintf(expect, sizeof(expect), "%" PRId64, v);
+        CHECK(strcmp(buf, expect) == 0);
+}
+
+int main(void)
+{
+        unsigned long i;
+
+        check_special();
+
+        check_int(0);
+        check_int(INT64_MAX);
+        check_int(INT64_MIN);
+        for (i = 0; i < NR_VALUES; i++)
+                check_int((int64_t)rng() >> (rng() % 64));
+
+        for (i = 0; i < NR_VALUES; i++) {
+                uint64_t bits = rng();
+                double d;
+
+                /* Any finite double */
+                d = from_bits(bits);
+                if (isfinite(d))
+                        check_double(d);
+
+                /* Subnormals: a zero exponent */
+                check_double(from_bits(bits & UINT64_C(0x800fffffffffffff)));
+
+                /* Integral doubles, on both sides of 2^53 */
+                check_double((double)((int64_t)rng() >> (rng() % 64)));
+        }
+
+        printf("test-numfmt: %lu doubles, %.3f%% longer than the shortest\n",
+               nr_checked, 100.0 * nr_longer / nr_checked);
+        CHECK(nr_longer * 100.0 <= nr_checked * MAX_LONGER_PERCENT);
+
+        return test_done("test-numfmt");
+}
@@ -0,0 +1,236 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * test-stream - memory use and output of the streaming conversion.
+ */
+
+#include "test.h"
+
+#include "converter.h"
+#include "cstring.h"
+#include "json.h"
+#include "util.h"
+#include "xmlstream.h"
+
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Size of the generated documents, and how much the peak RSS may grow
+ * while one is converted.
+ */
+#define DOC_SIZE (48 * 1024 * 1024)
+#define MAX_GROWTH (16 * 1024 * 1024)
+
+/* Nesting of the deep document, and the records it has at each level */
+#define DEEP_LEVELS 20000
+#define DEEP_RECORDS 20
+
+static size_t output_len;
+
+static int count_sink(void *data, const struct iovec *iov, int iovcnt)
+{
+        int i;
+
+        for (i = 0; i < iovcnt; i++)
+                output_len += iov[i].iov_len;
+
+        return 0;
+}
+
+static long peak_rss(void)
+{
+        struct rusage ru;
+
+        getrusage(RUSAGE_SELF, &ru);
+
+        return ru.ru_maxrss * 1024L;
+}
+
+static const char record[] =
+        "<item id=\"42\"><name>widget</name><price>1.5</price>"
+        "<tag>a</tag><tag>b</tag></item>\n";
+
+/* A root with many records */
+static void write_flat(FILE *f)
+{
+        size_t len;
+
+        fputs("<catalog>\n", f);
+        for (len = 0; len < DOC_SIZE; len += sizeof(record) - 1)
+                fputs(record, f);
+        fputs("</catalog>\n", f);
+}
+
+/* The records of write_flat() one level further down, in the only child
+ * of the root, whose value is as large as the document.
+ */
+static void write_wrapped(FILE *f)
+{
+        size_t len;
+
+        fputs("<feed><entries>\n", f);
+        for (len = 0; len < DOC_SIZE; len += sizeof(record) - 1)
+                fputs(record, f);
+        fputs("</entries></feed>\n", f);
+}
+
+/* Every level has a few records and the next level */
+static void write_deep(FILE *f)
+{
+        int i, j;
+
+        for (i = 0; i < DEEP_LEVELS; i++) {
+                fputs("<level>", f);
+                for (j = 0; j < DEEP_RECORDS; j++)
+                        fputs(record, f);
+        }
+        for (i = 0; i < DEEP_LEVELS; i++)
+                fputs("</level>", f);
+        fputc('\n', f);
+}
+
+/* Write a document with `write` to a temporary file, whose name is left
+ * in `path`.
+ */
+static int make_document(char *path, void (*write)(FILE *f))
+{
+        FILE *f;
+        int fd;
+
+        fd = mkstemp(path);
+        CHECK(fd >= 0);
+        if (fd < 0)
+                return -1;
+        f = fdopen(fd, "w");
+        write(f);
+        fclose(f);
+
+        return 0;
+}
+
+/* Convert the document written by `write` in a child process, so each
+ * document's peak RSS is measured on its own. The output must be at least
+ * half the size of the document, none of it may stay in memory.
+ */
+static void check_memory(const char *name, void (*write)(FILE *f),
+                         size_t min_output)
+{
+        char path[] = "/tmp/xml2json-test-stream-XXXXXX";
+        int status;
+        pid_t pid;
+
+        if (make_document(path, write) < 0)
+                return;
+
+        fflush(stdout);
+        pid = fork();
+        CHECK(pid >= 0);
+        if (pid == 0) {
+                struct converter conv;
+                struct json_writer *w;
+                long before, growth;
+
+                CHECK(converter_init(&conv, NULL, NULL,
+                                     XML_PARSE_COMPACT | XML_PARSE_HUGE) == 0);
+                w = malloc(sizeof(struct json_writer));
+                json_writer_init(w, count_sink, NULL);
+
+                before = peak_rss();
+                CHECK(xml_stream_convert(&conv, path, w) == 0);
+                json_writer_flush(w);
+                growth = peak_rss() - before;
+
+                CHECK(output_len > min_output);
+                CHECK(growth < MAX_GROWTH);
+                printf("test-stream: %s: %zu bytes out, peak RSS grew by "
+                       "%ld KiB\n", name, output_len, growth / 1024);
+
+                free(w);
+                converter_release(&conv);
+                exit(test_failures ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        if (pid > 0) {
+                CHECK(waitpid(pid, &status, 0) == pid);
+                CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        }
+        unlink(path);
+}
+
+/* Convert `xml` with the DOM and with the stream reader */
+static void check_same(struct converter *conv, const char *xml)
+{
+        char path[] = "/tmp/xml2json-test-stream-XXXXXX";
+        struct json_writer *w = malloc(sizeof(struct json_writer));
+        cstring dom, stream;
+        FILE *f;
+        int fd;
+
+        fd = mkstemp(path);
+        CHECK(fd >= 0);
+        if (fd < 0) {
+                free(w);
+                return;
+        }
+        f = fdopen(fd, "w");
+        fputs(xml, f);
+        fclose(f);
+
+        cstring_init(&dom, 0);
+        json_writer_init_cstring(w, &dom);
+        conv->stream = 0;
+        CHECK(converter_convert_file(conv, path, w) == 0);
+        json_writer_flush(w);
+
+        cstring_init(&stream, 0);
+        json_writer_init_cstring(w, &stream);
+        conv->stream = 1;
+        CHECK(converter_convert_file(conv, path, w) == 0);
+        json_writer_flush(w);
+
+        if (strcmp(dom.buf, stream.buf) != 0) {
+                fprintf(stderr, "test-stream: %s: %s from the DOM, %s "
+                        "from the stream\n", xml, dom.buf, stream.buf);
+                CHECK(strcmp(dom.buf, stream.buf) == 0);
+        }
+
+        cstring_release(&dom);
+        cstring_release(&stream);
+        free(w);
+        unlink(path);
+}
+
+int main(void)
+{
+        /* Text makes an element's value and hides its children wherever
+         * it is, runs are arrays however large their first value, and
+         * other content makes an empty object.
+         */
+        static const char *const same[] = {
+                "<m><b/>text</m>",
+                "<m>text<b/></m>",
+                "<r><m a=\"1\"><b><c/></b>t<d/></m><m/></r>",
+                "<r><a><b>1</b><b>2</b></a><a/><c/></r>",
+                "<r><a><a><a>1</a></a><a/></a></r>",
+                "<r><b><![CDATA[z]]></b><c><!-- c --></c><d> </d></r>",
+                "<!DOCTYPE r [<!ENTITY e \"<a>1</a><a>2</a>\">]>"
+                "<r>&e;<b/>&e;</r>",
+                "<!DOCTYPE r [<!ENTITY e \"x\">]><r><c/>&e;<b/></r>",
+        };
+        struct converter conv;
+        size_t i;
+
+        check_memory("flat", write_flat, DOC_SIZE / 2);
+        check_memory("wrapped", write_wrapped, DOC_SIZE / 2);
+        check_memory("deep", write_deep,
+                     DEEP_LEVELS * DEEP_RECORDS * (sizeof(record) - 1) / 2);
+
+        CHECK(converter_init(&conv, NULL, NULL, XML_PARSE_COMPACT) == 0);
+        for (i = 0; i < ARRAY_SIZE(same); i++)
+                check_same(&conv, same[i]);
+        converter_release(&conv);
+
+        return test_done("test-stream");
+}
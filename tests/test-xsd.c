@@ -0,0 +1,174 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * test-xsd - output shaped by a schema with a target namespace.
+ *
+ * tests/data/ns.xsd refers to its own complex types by a prefixed QName,
+ * and declares two `item` elements of different types, whose children
+ * share names but not types. Other elements come from a base type, a
+ * group and a reference to a global element. The same output is expected
+ * with the element table written to a file and mapped back.
+ */
+
+#include "test.h"
+
+#include "converter.h"
+#include "cstring.h"
+#include "json.h"
+#include "util.h"
+#include "xsdtable.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define XSD_FILE "tests/data/ns.xsd"
+#define XML_FILE "tests/data/ns.xml"
+
+static const char expected[] =
+        "{\"order\":{\"id\":42,"
+        "\"lines\":{\"item\":[{\"name\":\"pen\",\"price\":1.50,\"qty\":3}]},"
+        "\"notes\":{\"item\":{\"name\":\"gift\",\"qty\":\"007\","
+        "\"tag\":[\"red\"]}},"
+        "\"paid\":true,\"extra\":{\"code\":5,\"flag\":true},"
+        "\"email\":[\"pen@example.org\"],"
+        "\"total\":[{\"amount\":4.50}]}}\n";
+
+/* Convert XML_FILE with `conv` and compare the output with `expected` */
+static void check_convert(struct converter *conv, const char *what)
+{
+        struct json_writer *w = malloc(sizeof(struct json_writer));
+        cstring out;
+
+        cstring_init(&out, 0);
+        json_writer_init_cstring(w, &out);
+
+        CHECK(converter_convert_file(conv, XML_FILE, w) == 0);
+        json_writer_flush(w);
+        if (strcmp(out.buf, expected) != 0) {
+                fprintf(stderr, "test-xsd: %s: got %s", what, out.buf);
+                CHECK(strcmp(out.buf, expected) == 0);
+        }
+
+        cstring_release(&out);
+        free(w);
+}
+
+/* Convert with every backend and the stream reader */
+static void check_backends(struct converter *conv)
+{
+        static const struct {
+                const char *name;
+                enum convert_backend backend;
+        } backends[] = {
+                { "emit", BACKEND_EMIT },
+                { "tree", BACKEND_TREE },
+                { "tape", BACKEND_TAPE },
+        };
+        size_t i;
+
+        conv->xsd_types = 1;
+        conv->xsd_arrays = 1;
+
+        conv->stream = 0;
+        for (i = 0; i < ARRAY_SIZE(backends); i++) {
+                conv->backend = backends[i].backend;
+                check_convert(conv, backends[i].name);
+        }
+        conv->stream = 1;
+        check_convert(conv, "stream");
+}
+
+static int validity_errors;
+
+static void count_error(void *data, convert_error_ptr error)
+{
+        validity_errors++;
+}
+
+/* A document that fails to validate is still converted, and the failure
+ * reaches the caller and the converter's error handler.
+ */
+static void check_invalid(struct converter *conv)
+{
+        static const char xml[] =
+                "<tns:order xmlns:tns=\"urn:xml2json:test\">"
+                "<tns:id>x</tns:id><tns:paid>1</tns:paid></tns:order>";
+        struct json_writer *w = malloc(sizeof(struct json_writer));
+        cstring out;
+
+        cstring_init(&out, 0);
+        json_writer_init_cstring(w, &out);
+
+        conv->verror = count_error;
+        validity_errors = 0;
+        CHECK(converter_convert_buffer(conv, xml, sizeof(xml) - 1,
+                                       "<invalid>", w) == CONVERT_INVALID);
+        json_writer_flush(w);
+        CHECK(validity_errors > 0);
+        CHECK(strncmp(out.buf, "{\"order\":{\"id\":\"x\"", 18) == 0);
+
+        /* The next document starts out valid again */
+        validity_errors = 0;
+        CHECK(converter_convert_file(conv, XML_FILE, w) == 0);
+        json_writer_flush(w);
+        CHECK(validity_errors == 0);
+        conv->verror = NULL;
+
+        cstring_release(&out);
+        free(w);
+}
+
+/* Rewrite the version in the header of the table at `path` */
+static void set_version(const char *path, uint32_t version)
+{
+        int fd = open(path, O_WRONLY);
+
+        CHECK(fd >= 0);
+        if (fd < 0)
+                return;
+        CHECK(pwrite(fd, &version, sizeof(version),
+                     offsetof(struct xsd_table_header, version)) ==
+              sizeof(version));
+        close(fd);
+}
+
+int main(void)
+{
+        char path[] = "/tmp/xml2json-test-xsd-XXXXXX";
+        struct converter conv;
+        int fd;
+
+        CHECK(converter_init(&conv, XSD_FILE, NULL, XML_PARSE_COMPACT) == 0);
+        if (conv.table == NULL)
+                return test_done("test-xsd");
+        check_backends(&conv);
+        conv.stream = 0;
+        check_invalid(&conv);
+
+        fd = mkstemp(path);
+        CHECK(fd >= 0);
+        if (fd < 0)
+                return test_done("test-xsd");
+        close(fd);
+        CHECK(xsd_table_write(conv.table, path) == 0);
+        converter_release(&conv);
+
+        CHECK(converter_init(&conv, XSD_FILE, path, XML_PARSE_COMPACT) == 0);
+        CHECK(conv.table != NULL && conv.table->map != NULL);
+        if (conv.table)
+                check_backends(&conv);
+        converter_release(&conv);
+
+        /* Tables of earlier versions miss references, base types and
+         * groups, they are stale.
+         */
+        set_version(path, 2);
+        CHECK(converter_init(&conv, XSD_FILE, path, XML_PARSE_COMPACT) < 0);
+        set_version(path, 1);
+        CHECK(converter_init(&conv, XSD_FILE, path, XML_PARSE_COMPACT) < 0);
+
+        unlink(path);
+
+        return test_done("test-xsd");
+}
@@ -0,0 +1,42 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * test - helpers shared by the test programs.
+ */
+
+#ifndef XML2JSON_TEST_H
+#define XML2JSON_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int test_failures;
+
+/* CHECK():
+ * Report `cond` as a failure, with where it happened, if it is false.
+ */
+#define CHECK(cond)                                                     \
+        do {                                                            \
+                if (!(cond)) {                                          \
+                        fprintf(stderr, "%s:%d: check failed: %s\n",    \
+                                __FILE__, __LINE__, #cond);             \
+                        test_failures++;                                \
+                }                                                       \
+        } while (0)
+
+/* test_done():
+ * Returns the exit status of a test program, after a summary line.
+ */
+static inline int test_done(const char *name)
+{
+        if (test_failures) {
+                fprintf(stderr, "%s: %d check(s) failed\n", name,
+                        test_failures);
+                return EXIT_FAILURE;
+        }
+
+        printf("%s: ok\n", name);
+        return EXIT_SUCCESS;
+}
+
+#endif  /* XML2JSON_TEST_H */
@@ -66,6 +66,8 @@ extern char *xstrdup(const char *s);
 
 #define alloc_nr(x) (((x)+16)*3/2)
 
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
 /*
  * Realloc the buffer pointed at by variable 'x' so that it can hold
  * at least 'nr' entries; the number of entries currently allocated
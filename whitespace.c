@@ -0,0 +1,404 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * whitespace - normalisation of the white space in text content.
+ */
+
+#include "whitespace.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WS_HAVE_X86 1
+#endif
+
+/* The primitives every normalisation is built from, one set per
+ * instruction set.
+ */
+struct ws_kernel {
+        /* Index of the first (non) white space byte, or `len` */
+        size_t (*find_space)(const char *s, size_t len);
+        size_t (*find_text)(const char *s, size_t len);
+        /* Copy `src` to `dst` without its white space */
+        size_t (*strip)(char *dst, const char *src, size_t len);
+};
+
+static inline int is_ws(unsigned char c)
+{
+        return c == 0x20 || c == 0x9 || c == 0xa || c == 0xd;
+}
+
+/*
+ * Scalar
+ */
+
+static size_t scalar_find_space(const char *s, size_t len)
+{
+        size_t i;
+
+        for (i = 0; i < len && !is_ws(s[i]); i++)
+                ;
+        return i;
+}
+
+static size_t scalar_find_text(const char *s, size_t len)
+{
+        size_t i;
+
+        for (i = 0; i < len && is_ws(s[i]); i++)
+                ;
+        return i;
+}
+
+static size_t scalar_strip(char *dst, const char *src, size_t len)
+{
+        size_t i, n = 0;
+
+        for (i = 0; i < len; i++) {
+                if (!is_ws(src[i]))
+                        dst[n++] = src[i];
+        }
+
+        return n;
+}
+
+static const struct ws_kernel scalar_kernel = {
+        scalar_find_space,
+        scalar_find_text,
+        scalar_strip,
+};
+
+#ifdef WS_HAVE_X86
+
+/* Copy the `nr` bytes of a block whose bit is set in `keep`, without
+ * branching on the data.
+ */
+static inline size_t copy_kept(char *dst, const char *src, uint32_t keep,
+                               unsigned int nr)
+{
+        size_t n = 0;
+        unsigned int i;
+
+        for (i = 0; i < nr; i++) {
+                dst[n] = src[i];
+                n += (keep >> i) & 1;
+        }
+
+        return n;
+}
+
+/*
+ * SSE2, 16 bytes at a time
+ */
+
+__attribute__((target("sse2")))
+static inline uint32_t sse2_mask(const char *s)
+{
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)s);
+        __m128i m;
+
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(0x20)),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8(0x9)));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(0xa)));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(0xd)));
+
+        return (uint32_t)_mm_movemask_epi8(m);
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_find_space(const char *s, size_t len)
+{
+        size_t i;
+
+        for (i = 0; i + 16 <= len; i += 16) {
+                uint32_t mask = sse2_mask(s + i);
+
+                if (mask)
+                        return i + __builtin_ctz(mask);
+        }
+
+        return i + scalar_find_space(s + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_find_text(const char *s, size_t len)
+{
+        size_t i;
+
+        for (i = 0; i + 16 <= len; i += 16) {
+                uint32_t mask = ~sse2_mask(s + i) & 0xffff;
+
+                if (mask)
+                        return i + __builtin_ctz(mask);
+        }
+
+        return i + scalar_find_text(s + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_strip(char *dst, const char *src, size_t len)
+{
+        size_t i, n = 0;
+
+        for (i = 0; i + 16 <= len; i += 16) {
+                uint32_t mask = sse2_mask(src + i);
+
+                if (mask == 0) {
+                        /* n <= i, so the store stays within `len` */
+                        memcpy(dst + n, src + i, 16);
+                        n += 16;
+                } else if (mask != 0xffff) {
+                        n += copy_kept(dst + n, src + i, ~mask, 16);
+                }
+        }
+
+        return n + scalar_strip(dst + n, src + i, len - i);
+}
+
+static const struct ws_kernel sse2_kernel = {
+        sse2_find_space,
+        sse2_find_text,
+        sse2_strip,
+};
+
+/*
+ * AVX2, 32 bytes at a time
+ */
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2_mask(const char *s)
+{
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)s);
+        __m256i m;
+
+        m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x20)),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x9)));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0xa)));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0xd)));
+
+        return (uint32_t)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_find_space(const char *s, size_t len)
+{
+        size_t i;
+
+        for (i = 0; i + 32 <= len; i += 32) {
+                uint32_t mask = avx2_mask(s + i);
+
+                if (mask)
+                        return i + __builtin_ctz(mask);
+        }
+
+        return i + sse2_find_space(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_find_text(const char *s, size_t len)
+{
+        size_t i;
+
+        for (i = 0; i + 32 <= len; i += 32) {
+                uint32_t mask = ~avx2_mask(s + i);
+
+                if (mask)
+                        return i + __builtin_ctz(mask);
+        }
+
+        return i + sse2_find_text(s + i, len - i);
+}
+
+/* For each 8 bit mask of bytes to keep, the pshufb indices moving them to
+ * the front of an 8 byte group.
+ */
+static uint64_t compact_shuffle[256];
+
+static void compact_shuffle_init(void)
+{
+        unsigned int keep, i, n;
+
+        for (keep = 0; keep < 256; keep++) {
+                uint64_t idx = 0;
+
+                for (i = 0, n = 0; i < 8; i++) {
+                        if (keep & (1 << i))
+                                idx |= (uint64_t)i << (8 * n++);
+                }
+                compact_shuffle[keep] = idx;
+        }
+}
+
+/* Compact the 8 bytes at `src` whose bit is set in `keep` into `dst`. All
+ * 8 bytes of `dst` are written.
+ */
+__attribute__((target("avx2")))
+static inline size_t compact8(char *dst, const char *src, unsigned int keep)
+{
+        __m128i v = _mm_loadl_epi64((const __m128i *)(const void *)src);
+        __m128i idx = _mm_cvtsi64_si128((long long)compact_shuffle[keep]);
+
+        _mm_storel_epi64((__m128i *)(void *)dst, _mm_shuffle_epi8(v, idx));
+
+        return __builtin_popcount(keep);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_strip(char *dst, const char *src, size_t len)
+{
+        size_t i, n = 0;
+        unsigned int j;
+
+        for (i = 0; i + 32 <= len; i += 32) {
+                uint32_t mask = avx2_mask(src + i);
+
+                if (mask == 0) {
+                        memcpy(dst + n, src + i, 32);
+                        n += 32;
+                } else if (mask != 0xffffffff) {
+                        /* n <= i + j, so each 8 byte store stays within
+                         * `len`
+                         */
+                        for (j = 0; j < 32; j += 8)
+                                n += compact8(dst + n, src + i + j,
+                                              (~mask >> j) & 0xff);
+                }
+        }
+
+        return n + sse2_strip(dst + n, src + i, len - i);
+}
+
+static const struct ws_kernel avx2_kernel = {
+        avx2_find_space,
+        avx2_find_text,
+        avx2_strip,
+};
+
+#endif  /* WS_HAVE_X86 */
+
+static const struct ws_kernel *kernel = &scalar_kernel;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void ws_select_kernel(void)
+{
+#ifdef WS_HAVE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+                compact_shuffle_init();
+                kernel = &avx2_kernel;
+        }
+        else if (__builtin_cpu_supports("sse2"))
+                kernel = &sse2_kernel;
+#endif
+}
+
+/* Length of `s` without its trailing white space */
+static size_t rtrim_len(const char *s, size_t len)
+{
+        while (len && is_ws(s[len - 1]))
+                len--;
+
+        return len;
+}
+
+static size_t ws_collapse(char *dst, const char *src, size_t len)
+{
+        size_t i = 0, n = 0;
+
+        for (;;) {
+                size_t run = kernel->find_space(src + i, len - i);
+
+                memcpy(dst + n, src + i, run);
+                n += run;
+                i += run;
+                if (i == len)
+                        break;
+
+                i += kernel->find_text(src + i, len - i);
+                dst[n++] = ' ';
+        }
+
+        return n;
+}
+
+/*
+ * Public Functions
+ */
+
+int ws_mode_parse(const char *name, enum ws_mode *mode)
+{
+        if (strcmp(name, "strip") == 0)
+                *mode = WS_STRIP;
+        else if (strcmp(name, "trim") == 0)
+                *mode = WS_TRIM;
+        else if (strcmp(name, "collapse") == 0)
+                *mode = WS_COLLAPSE;
+        else if (strcmp(name, "preserve") == 0)
+                *mode = WS_PRESERVE;
+        else
+                return -1;
+
+        return 0;
+}
+
+size_t ws_normalize(char *dst, const char *src, size_t len,
+                    enum ws_mode mode)
+{
+        size_t start;
+
+        pthread_once(&kernel_once, ws_select_kernel);
+
+        if (mode == WS_STRIP)
+                return kernel->strip(dst, src, len);
+
+        start = kernel->find_text(src, len);
+        if (start == len)
+                return 0;
+
+        if (mode == WS_PRESERVE) {
+                memcpy(dst, src, len);
+                return len;
+        }
+
+        src += start;
+        len = rtrim_len(src, len - start);
+
+        if (mode == WS_COLLAPSE)
+                return ws_collapse(dst, src, len);
+
+        memcpy(dst, src, len);
+        return len;
+}
+
+int ws_is_blank(const char *src, size_t len)
+{
+        pthread_once(&kernel_once, ws_select_kernel);
+
+        return kernel->find_text(src, len) == len;
+}
+
+int ws_use_kernel(const char *isa)
+{
+        pthread_once(&kernel_once, ws_select_kernel);
+
+        if (strcmp(isa, "scalar") == 0) {
+                kernel = &scalar_kernel;
+                return 0;
+        }
+#ifdef WS_HAVE_X86
+        if (strcmp(isa, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+                kernel = &sse2_kernel;
+                return 0;
+        }
+        if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+                compact_shuffle_init();
+                kernel = &avx2_kernel;
+                return 0;
+        }
+#endif
+
+        return -1;
+}
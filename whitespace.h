@@ -0,0 +1,60 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * whitespace - normalisation of the white space in text content.
+ */
+
+#ifndef XML2JSON_WHITESPACE_H
+#define XML2JSON_WHITESPACE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* What happens to the XML white space (0x20, 0x9, 0xa and 0xd) in text */
+enum ws_mode {
+        WS_STRIP,               /* remove all of it, the default */
+        WS_TRIM,                /* remove it at both ends */
+        WS_COLLAPSE,            /* trim, and turn every run into a space */
+        WS_PRESERVE,            /* keep the text as it is */
+};
+
+/* ws_mode_parse():
+ * Set `mode` from its name: strip, trim, collapse or preserve. Returns 0
+ * on success, -1 for an unknown name.
+ */
+extern int ws_mode_parse(const char *name, enum ws_mode *mode);
+
+/* ws_normalize():
+ * Write the `len` bytes of text at `src` to `dst`, with the white space
+ * treated according to `mode`. `dst` must have room for `len` bytes and
+ * must not overlap `src`. Returns the number of bytes written, which is 0
+ * when `src` is only white space, whatever the mode.
+ *
+ * Text is scanned in 16 or 32 byte blocks with SSE2 or AVX2, whichever the
+ * CPU supports, and a byte at a time elsewhere.
+ */
+extern size_t ws_normalize(char *dst, const char *src, size_t len,
+                           enum ws_mode mode);
+
+/* ws_is_blank():
+ * Returns true if the `len` bytes at `src` are only white space, i.e. if
+ * ws_normalize() leaves nothing of them.
+ */
+extern int ws_is_blank(const char *src, size_t len);
+
+/* ws_use_kernel():
+ * Scan text with the "scalar", "sse2" or "avx2" kernel from now on,
+ * instead of the one picked for the CPU, so tests can compare them.
+ * Returns 0 on success, -1 if the name is unknown or the CPU can't run
+ * the kernel.
+ */
+extern int ws_use_kernel(const char *isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_WHITESPACE_H */
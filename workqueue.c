@@ -0,0 +1,156 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * workqueue - a fixed pool of worker threads with in-order completion.
+ */
+
+#include "workqueue.h"
+
+#include "util.h"
+
+#include <string.h>
+
+struct workqueue_thread {
+        struct workqueue *wq;
+        void *worker;
+};
+
+static void *workqueue_thread_main(void *data)
+{
+        struct workqueue_thread *t = data;
+        struct workqueue *wq = t->wq;
+        void *worker = t->worker;
+
+        free(t);
+
+        pthread_mutex_lock(&wq->lock);
+        for (;;) {
+                struct workqueue_slot *slot;
+
+                while (wq->next == wq->tail && !wq->finished)
+                        pthread_cond_wait(&wq->work_cond, &wq->lock);
+
+                if (wq->next == wq->tail)
+                        break;
+
+                slot = &wq->slots[wq->next++ % wq->size];
+                pthread_mutex_unlock(&wq->lock);
+
+                wq->fn(worker, slot->job);
+
+                pthread_mutex_lock(&wq->lock);
+                slot->done = 1;
+                pthread_cond_broadcast(&wq->done_cond);
+        }
+        pthread_mutex_unlock(&wq->lock);
+
+        return NULL;
+}
+
+/*
+ * Public Functions
+ */
+
+void workqueue_init(struct workqueue *wq, size_t nr_threads, size_t window,
+                    workqueue_fn fn, void **workers)
+{
+        size_t i;
+
+        memset(wq, 0, sizeof(struct workqueue));
+
+        pthread_mutex_init(&wq->lock, NULL);
+        pthread_cond_init(&wq->work_cond, NULL);
+        pthread_cond_init(&wq->done_cond, NULL);
+
+        wq->fn = fn;
+        wq->size = window ? window : 1;
+        wq->slots = xcalloc(wq->size, sizeof(struct workqueue_slot));
+
+        wq->nr_threads = nr_threads;
+        wq->threads = xcalloc(nr_threads, sizeof(pthread_t));
+
+        for (i = 0; i < nr_threads; i++) {
+                struct workqueue_thread *t;
+                int ret;
+
+                t = xmalloc(sizeof(struct workqueue_thread));
+                t->wq = wq;
+                t->worker = workers[i];
+
+                ret = pthread_create(&wq->threads[i], NULL,
+                                     workqueue_thread_main, t);
+                if (ret) {
+                        fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+                        exit(EXIT_FAILURE);
+                }
+        }
+}
+
+int workqueue_full(struct workqueue *wq)
+{
+        int full;
+
+        pthread_mutex_lock(&wq->lock);
+        full = (wq->tail - wq->head == wq->size);
+        pthread_mutex_unlock(&wq->lock);
+
+        return full;
+}
+
+void workqueue_push(struct workqueue *wq, void *job)
+{
+        struct workqueue_slot *slot;
+
+        pthread_mutex_lock(&wq->lock);
+
+        slot = &wq->slots[wq->tail % wq->size];
+        slot->job = job;
+        slot->done = 0;
+        wq->tail++;
+
+        pthread_cond_signal(&wq->work_cond);
+        pthread_mutex_unlock(&wq->lock);
+}
+
+void *workqueue_pop(struct workqueue *wq)
+{
+        struct workqueue_slot *slot;
+        void *job = NULL;
+
+        pthread_mutex_lock(&wq->lock);
+
+        if (wq->head != wq->tail) {
+                slot = &wq->slots[wq->head % wq->size];
+                while (!slot->done)
+                        pthread_cond_wait(&wq->done_cond, &wq->lock);
+
+                job = slot->job;
+                slot->job = NULL;
+                wq->head++;
+        }
+
+        pthread_mutex_unlock(&wq->lock);
+
+        return job;
+}
+
+void workqueue_release(struct workqueue *wq)
+{
+        size_t i;
+
+        pthread_mutex_lock(&wq->lock);
+        wq->finished = 1;
+        pthread_cond_broadcast(&wq->work_cond);
+        pthread_mutex_unlock(&wq->lock);
+
+        for (i = 0; i < wq->nr_threads; i++)
+                pthread_join(wq->threads[i], NULL);
+
+        pthread_cond_destroy(&wq->done_cond);
+        pthread_cond_destroy(&wq->work_cond);
+        pthread_mutex_destroy(&wq->lock);
+
+        free(wq->threads);
+        free(wq->slots);
+        memset(wq, 0, sizeof(struct workqueue));
+}
@@ -0,0 +1,79 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * workqueue - a fixed pool of worker threads with in-order completion.
+ */
+
+#ifndef XML2JSON_WORKQUEUE_H
+#define XML2JSON_WORKQUEUE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Run `job` on a worker thread. `worker` is the private data of the thread
+ * picking up the job, as passed to workqueue_init().
+ */
+typedef void (*workqueue_fn)(void *worker, void *job);
+
+struct workqueue_slot {
+        void *job;
+        int done;
+};
+
+struct workqueue {
+        pthread_mutex_t lock;
+        pthread_cond_t work_cond;       /* a job was queued, or finish */
+        pthread_cond_t done_cond;       /* a job was completed */
+
+        workqueue_fn fn;
+
+        /* Jobs are kept in a ring, in the order they were queued:
+         * [head, next) are being worked on, [next, tail) are waiting.
+         */
+        struct workqueue_slot *slots;
+        size_t size;
+        size_t head, next, tail;
+        int finished;
+
+        pthread_t *threads;
+        size_t nr_threads;
+};
+
+/* workqueue_init():
+ * Start `nr_threads` threads, thread `i` calls `fn` with `workers[i]`. At
+ * most `window` jobs can be queued or in progress at any time.
+ */
+extern void workqueue_init(struct workqueue *wq, size_t nr_threads,
+                           size_t window, workqueue_fn fn, void **workers);
+
+/* workqueue_full():
+ * Returns true if no more jobs can be queued before one is popped.
+ */
+extern int workqueue_full(struct workqueue *wq);
+
+/* workqueue_push():
+ * Queue a job. The queue must not be full.
+ */
+extern void workqueue_push(struct workqueue *wq, void *job);
+
+/* workqueue_pop():
+ * Wait for the oldest job to complete and return it. Returns NULL if
+ * there are no jobs left.
+ */
+extern void *workqueue_pop(struct workqueue *wq);
+
+/* workqueue_release():
+ * Stop the worker threads and release the queue. All the jobs must have
+ * been popped.
+ */
+extern void workqueue_release(struct workqueue *wq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_WORKQUEUE_H */
@@ -3,12 +3,13 @@
  * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
  */
 
-#define LIBXML_SCHEMAS_ENABLED
+#include "converter.h"
 #include "cstring.h"
-#include "htable.h"
 #include "json.h"
+#include "server.h"
 #include "util.h"
-#include "parsexsd.h"
+#include "workqueue.h"
+#include "xmlsplit.h"
 
 #include <errno.h>
 #include <stdio.h>
@@ -16,460 +17,495 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/mman.h>
 #include <string.h>
 #include <getopt.h>
 
 #include <libxml/parser.h>
-#include <libxml/chvalid.h>
-#include <libxml/xpath.h>
-#include <libxml/xmlschemastypes.h>
-#include <libxml/schemasInternals.h>
 
-/**
- * Hashtable
- */
-enum  xml_entry_type {
-        ENTRY_TYPE_NULL,
-        ENTRY_TYPE_BOOL,
-        ENTRY_TYPE_STRING,
-        ENTRY_TYPE_NUMBER,
-        ENTRY_TYPE_ARRAY,
-        ENTRY_TYPE_OBJECT,
-};
-
-struct xml_htable {
-        struct htable table;
-};
-
-struct xml_htable_entry {
-        struct htable_entry entry;
-        enum xml_entry_type type;
-        char *key;
-        size_t keylen;
-        void *value;
+/* List of input files */
+struct inputs {
+        char **files;
+        size_t nr;
+        size_t alloc;
 };
 
-/* Global variable not prefered, need to find the correct function to pass - for now developing functionality */
-
-static struct xml_htable_entry *alloc_xml_htable_entry(char *key,
-                                                       size_t keylen,
-                                                       void *value,
-                                                       enum xml_entry_type type)
+static void inputs_add(struct inputs *in, char *file)
 {
-        struct xml_htable_entry *e;
-
-        e = xmalloc(sizeof(struct xml_htable_entry));
-        e->key = xcalloc(1, keylen);
-        memcpy(e->key, key, keylen);
-        e->keylen = keylen;
-        e->value = value;
-        e->type = type;
-        return e;
+        ALLOC_GROW(in->files, in->nr + 1, in->alloc);
+        in->files[in->nr++] = file;
 }
 
-static void free_xml_htable_entry(struct xml_htable_entry **e)
+/* Read the input files from a manifest, one path per line. `-` reads the
+ * manifest from stdin.
+ */
+static int inputs_read_manifest(struct inputs *in, const char *manifest)
 {
-        if (e && *e) {
-                free((*e)->key);
-                (*e)->key = NULL;
-                (*e)->keylen = 0;
-                if ((*e)->type == ENTRY_TYPE_STRING) {
-                        free((*e)->value);
-                }
+        FILE *fp;
+        char *line = NULL;
+        size_t alloc = 0;
+        ssize_t len;
+
+        if (strcmp(manifest, "-") == 0)
+                fp = stdin;
+        else if ((fp = fopen(manifest, "r")) == NULL)
+                return -1;
 
-                (*e)->value = NULL;
-                free(*e);
-                *e = NULL;
+        while ((len = getline(&line, &alloc, fp)) != -1) {
+                while (len > 0 && (line[len - 1] == '\n' ||
+                                   line[len - 1] == '\r'))
+                        line[--len] = '\0';
+                if (len == 0)
+                        continue;
+                inputs_add(in, xstrdup(line));
         }
-}
 
-static int xml_htable_entry_cmpfn(const void *unused1 _unused_,
-                                  const void *entry1,
-                                  const void *entry2,
-                                  const void *unused2 _unused_)
-{
-        const struct xml_htable_entry *e1 = entry1;
-        const struct xml_htable_entry *e2 = entry2;
+        free(line);
+        if (fp != stdin)
+                fclose(fp);
 
-        return memcmp_raw(e1->key, e1->keylen, e2->key, e2->keylen);
+        return 0;
 }
 
-static void xml_htable_init(struct xml_htable *ht)
+/* Output file for `xmlfile` in `outdir`: the base name of the input with a
+ * `.xml` extension replaced by `.json`.
+ */
+static char *output_path(const char *outdir, const char *xmlfile)
 {
-        htable_init(&ht->table, xml_htable_entry_cmpfn, NULL, 0);
+        const char *base = strrchr(xmlfile, '/');
+        cstring path;
+        size_t len;
+
+        base = base ? base + 1 : xmlfile;
+        len = strlen(base);
+        if (len > 4 && strcasecmp(base + len - 4, ".xml") == 0)
+                len -= 4;
+
+        cstring_init(&path, 0);
+        cstring_addstr(&path, outdir);
+        cstring_addch(&path, '/');
+        cstring_add(&path, base, len);
+        cstring_addstr(&path, ".json");
+
+        return cstring_detach(&path, NULL);
 }
 
-static void *xml_htable_get(struct xml_htable *ht, char *key,
-                            size_t keylen)
+/* Validation errors, in the format of libxml2's own messages */
+static void print_validity_error(void *data, convert_error_ptr error)
 {
-        struct xml_htable_entry k;
-        struct xml_htable_entry *e;
-
-        if (!ht->table.size)
-                xml_htable_init(ht);
-
-        htable_entry_init(&k, bufhash(key, keylen));
-        k.key = key;
-        k.keylen = keylen;
-        e = htable_get(&ht->table, &k, NULL);
-
-        return e ? e : NULL;
+        fprintf(stderr, "%s:%d: Schemas validity error : %s",
+                error->file ? error->file : "", error->line, error->message);
 }
 
-static void xml_htable_put(struct xml_htable *ht,
-                           char *key,
-                           size_t keylen, void *value,
-                           enum xml_entry_type type)
+/* Convert one file, either as a whole or, with `split_at`, as one line per
+ * record using `jobs` threads. With a schema, whether the file validates is
+ * reported, documents that don't are still converted.
+ */
+static int convert_file(struct converter *conv, const char *xmlfile,
+                        const char *split_at, size_t jobs,
+                        struct json_writer *w)
 {
-        struct xml_htable_entry *e;
+        int ret;
 
-        if (!ht->table.size)
-                xml_htable_init(ht);
+        if (split_at)
+                return xml_split_convert(conv, xmlfile, split_at, jobs, w);
 
-        e = alloc_xml_htable_entry(key, keylen, value, type);
-        htable_entry_init(e, bufhash(key, keylen));
+        ret = converter_convert_file(conv, xmlfile, w);
+        if (conv->vctxt && ret == 0)
+                fprintf(stderr, "%s validates\n", xmlfile);
+        else if (ret == CONVERT_INVALID)
+                fprintf(stderr, "%s fails to validate\n", xmlfile);
 
-        htable_put(&ht->table, e);
+        return ret < 0 ? -1 : 0;
 }
 
-static void *xml_htable_remove(struct xml_htable *ht, char *key,
-                               size_t keylen)
+/* The output of a file of a batch written to stdout, held back until the
+ * file has converted, so that a file failing half way through, as it can
+ * with --stream, leaves nothing behind. Up to BATCH_BUFFER_MAX bytes are
+ * kept in memory, the rest goes to a temporary file.
+ */
+#define BATCH_BUFFER_MAX (4 * 1024 * 1024)
+
+struct batch_buffer {
+        cstring buf;
+        FILE *spill;                    /* NULL until `buf` is full */
+};
+
+static int batch_sink(void *data, const struct iovec *iov, int iovcnt)
 {
-        struct xml_htable_entry e;
+        struct batch_buffer *b = data;
+        int i;
 
-        if (!ht->table.size)
-                xml_htable_init(ht);
+        for (i = 0; i < iovcnt; i++) {
+                if (b->spill == NULL &&
+                    b->buf.len + iov[i].iov_len <= BATCH_BUFFER_MAX) {
+                        cstring_add(&b->buf, iov[i].iov_base, iov[i].iov_len);
+                        continue;
+                }
 
-        htable_entry_init(&e, bufhash(key, keylen));
+                if (b->spill == NULL && (b->spill = tmpfile()) == NULL)
+                        return -1;
+                if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, b->spill) !=
+                    iov[i].iov_len)
+                        return -1;
+        }
 
-        return htable_remove(&ht->table, &e, key);
+        return 0;
 }
 
-static void xml_htable_free(struct xml_htable *ht)
+/* Hand the output held in `b` to `w`, then empty `b` for the next file */
+static int batch_write(struct batch_buffer *b, struct json_writer *w)
 {
-        struct htable_iter iter;
-        struct xml_htable_entry *e;
-
-        htable_iter_init(&ht->table, &iter);
-        while ((e = htable_iter_next(&iter))) {
-                free_xml_htable_entry(&e);
-        }
-
-        htable_free(&ht->table, 0);
+        char chunk[65536];
+        size_t n;
+        int ret = 0;
+
+        if (w)
+                json_writer_add(w, b->buf.buf, b->buf.len);
+        cstring_setlen(&b->buf, 0);
+
+        if (b->spill == NULL)
+                return 0;
+
+        rewind(b->spill);
+        while (w && (n = fread(chunk, 1, sizeof(chunk), b->spill)) > 0)
+                json_writer_add(w, chunk, n);
+        if (ferror(b->spill))
+                ret = -1;
+        fclose(b->spill);
+        b->spill = NULL;
+
+        return ret;
 }
 
-/**
- * XML parsing
+/* Convert one file of a batch written to stdout through `out`, and hand it
+ * to `w` only once it has converted. convert_parallel() does the same.
  */
-
-static void *parse_xmlnode(xmlNodePtr node, enum xml_entry_type *type);
-
-static void *parse_xml_element_attributes(xmlAttrPtr attr, void *attrobj,
-                                          enum xml_entry_type *type)
-
+static int convert_buffered(struct converter *conv, const char *xmlfile,
+                            const char *split_at, size_t jobs,
+                            struct batch_buffer *out, struct json_writer *w)
 {
-        if (attr == NULL) {
-                *type = ENTRY_TYPE_NULL;
-                return NULL;
-        }
-
-        if (attrobj == NULL)
-                attrobj = json_new();
-
-        while (attr != NULL) {
-                cstring str;
-                void *val;
+        struct json_writer *bw = xmalloc(sizeof(struct json_writer));
+        int ret;
 
-                /* Append '@' to the attribute name */
-                cstring_init(&str, 0);
-                cstring_addch(&str, '@');
-                cstring_addstr(&str, (char *)attr->name);
+        json_writer_init(bw, batch_sink, out);
+        ret = convert_file(conv, xmlfile, split_at, jobs, bw);
+        if (json_writer_flush(bw) < 0)
+                ret = -1;
+        if (batch_write(out, ret == 0 ? w : NULL) < 0)
+                ret = -1;
 
-                val = parse_xmlnode(attr->children, type);
+        free(bw);
 
-                if (*type == ENTRY_TYPE_STRING) {
-                        JsonObject *strobj;
-                        strobj = json_string_obj(val);
-                        free(val);
-                        json_prepend_member(attrobj, str.buf, strobj);
-                } else {
-                        printf("attributes: non string type entry!\n");
-                }
-
-                attr = attr->next;
-
-                cstring_release(&str);
-        }
-
-        *type = ENTRY_TYPE_OBJECT;
-        return attrobj;
+        return ret;
 }
 
-static int parse_xml_element_node(xmlNodePtr node, struct xml_htable *ht,
-                                    enum xml_entry_type *type)
+static int convert_to_dir(struct converter *conv, const char *xmlfile,
+                          const char *split_at, size_t jobs,
+                          const char *outdir, struct json_writer *w)
 {
-        void *val = NULL;
-        int has_attr = 0;
-        void *attrval = NULL;
-        JsonObject *attrobj = NULL;
+        char *path = output_path(outdir, xmlfile);
+        int fd, ret;
 
-        if (node == NULL) {
-                *type = ENTRY_TYPE_NULL;
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                free(path);
                 return -1;
         }
 
-        val = parse_xmlnode(node->children, type);
-        switch (*type) {
-        case ENTRY_TYPE_NULL:
-                xfree(val);
-                val = NULL;
-                break;
-        case ENTRY_TYPE_STRING:
-                if (node->properties) {
-                        attrobj = json_new();
-                        json_prepend_member(attrobj, "#text",
-                                            json_string_obj(val));
-                        free(val);
-                        val = attrobj;
-                }
-                break;
-        case ENTRY_TYPE_OBJECT:
-        case ENTRY_TYPE_ARRAY:
-        case ENTRY_TYPE_BOOL:
-        case ENTRY_TYPE_NUMBER:
-        default:
-                break;
-        }
-
-        if (node->properties != NULL) {
-                /* We need to parse XML attributes */
-                attrval = parse_xml_element_attributes(node->properties, val,
-                                                       type);
-                if (val == NULL)
-                        val = attrval;
-                has_attr = 1;
+        json_writer_init_fd(w, fd);
+        ret = convert_file(conv, xmlfile, split_at, jobs, w);
+        if (json_writer_flush(w) < 0) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                ret = -1;
         }
 
-        xml_htable_put(ht, (char *)node->name, xmlStrlen(node->name),
-                       val, *type);
+        close(fd);
+        if (ret < 0)
+                unlink(path);
+        free(path);
 
-        return has_attr;
+        return ret;
 }
 
-static char *parse_xml_text_node(xmlNodePtr node, enum xml_entry_type *type,
-                                 size_t *slen)
-{
-        xmlChar *content;
-        cstring str;
-        size_t len = 0, i = 0;
-
-        if (node->content == NULL)
-                return NULL;
-
-        cstring_init(&str, 0);
-
-        content = xmlNodeGetContent(node);
-        len = xmlStrlen(content);
-
-        for (i = 0; i < len; i++) {
-                if ((content[i] == 0x20) ||
-                    ((0x9 <= content[i]) && (content[i] <= 0xa)) ||
-                    (content[i] == 0xd) ||
-                    (content[i] == '\r') ||
-                    (content[i] == '\n') ||
-                    (content[i] == 0x0a)) {
-                        continue;
-                }
-                cstring_addch(&str, content[i]);
-        }
+/* Parallel conversion: every worker thread owns a converter, with its own
+ * libxml2 contexts, and a writer. Output to stdout is collected per file and
+ * written out in input order.
+ */
+struct file_job {
+        const char *xmlfile;
+        const char *outdir;
+        struct batch_buffer out;
+        int ret;
+};
 
-        if (!content) *type = ENTRY_TYPE_NULL;
+struct file_worker {
+        struct converter conv;
+        struct json_writer w;
+};
 
-        xmlFree(content);
+static void convert_job(void *worker, void *data)
+{
+        struct file_worker *fw = worker;
+        struct file_job *job = data;
 
-        if (str.len == 0) {
-                *type = ENTRY_TYPE_NULL;
-                cstring_release(&str);
-        } else {
-                *type = ENTRY_TYPE_STRING;
+        if (job->outdir) {
+                job->ret = convert_to_dir(&fw->conv, job->xmlfile, NULL, 1,
+                                          job->outdir, &fw->w);
+                return;
         }
 
-        return cstring_detach(&str, slen);
+        json_writer_init(&fw->w, batch_sink, &job->out);
+        job->ret = convert_file(&fw->conv, job->xmlfile, NULL, 1, &fw->w);
+        if (json_writer_flush(&fw->w) < 0)
+                job->ret = -1;
 }
 
-static JsonObject *xml_htable_to_json_obj(struct xml_htable *ht)
+static int finish_job(struct file_job *job, struct json_writer *w)
 {
-        JsonObject *jobj = NULL;
-        struct htable_iter iter;
-        struct xml_htable_entry *e = NULL;
-
-        jobj = json_new();
+        int ret = job->ret;
 
-        htable_iter_init_ordered(&ht->table, &iter);
+        if (batch_write(&job->out, ret == 0 && !job->outdir ? w : NULL) < 0)
+                ret = -1;
+        if (ret < 0)
+                fprintf(stderr, "%s: failed to convert\n", job->xmlfile);
 
-        while ((e = htable_iter_next_ordered(&iter))) {
-                if (e->entry.count > 1) { /* Array */
-                        JsonObject *array = NULL;
-                        struct xml_htable_entry *temp = NULL;
-                        temp = e;
+        cstring_release(&job->out.buf);
+        free(job);
 
-                        array = json_array_obj();
-
-                        if (e->type == ENTRY_TYPE_NULL)
-                                json_prepend_to_array(array, json_null_obj());
-                        else if (e->type == ENTRY_TYPE_STRING)
-                                json_prepend_to_array(array,
-                                                      json_string_obj(e->value));
-                        else
-                                json_prepend_to_array(array, e->value);
-
-
-                        /* Parse the other entries for the same key */
-                        while ((temp = htable_get_next(&ht->table, temp))) {
-                                if (temp->type == ENTRY_TYPE_NULL)
-                                        json_prepend_to_array(array,
-                                                              json_null_obj());
-                                else if (temp->type == ENTRY_TYPE_STRING)
-                                        json_prepend_to_array(array,
-                                                              json_string_obj(temp->value));
-                                else
-                                        json_prepend_to_array(array, temp->value);
-                        }
-
-                        json_append_member(jobj, (char *)e->key, array);
+        return ret;
+}
 
-                } else {                  /* Normal(?) non-array object */
-                        if (e->type == ENTRY_TYPE_NULL)
-                                json_append_member(jobj, e->key,
-                                                   json_null_obj());
-                        else if (e->type == ENTRY_TYPE_STRING)
-                                json_append_member(jobj, e->key,
-                                                   json_string_obj(e->value));
-                        else
-                                json_append_member(jobj, e->key, e->value);
+static int convert_parallel(struct converter *conv, struct inputs *in,
+                            const char *outdir, size_t jobs,
+                            struct json_writer *w)
+{
+        struct workqueue wq;
+        struct file_worker *workers;
+        struct file_job *job;
+        void **data;
+        size_t i;
+        int failed = 0;
+
+        workers = xcalloc(jobs, sizeof(struct file_worker));
+        data = xcalloc(jobs, sizeof(void *));
+        for (i = 0; i < jobs; i++) {
+                if (converter_clone(&workers[i].conv, conv) < 0) {
+                        fprintf(stderr, "Failed to initialise the converter\n");
+                        exit(EXIT_FAILURE);
                 }
+                data[i] = &workers[i];
         }
 
-        return jobj;
-}
+        /* Keep a few files per worker in flight, so a slow file doesn't
+         * stall the others while its output is awaited.
+         */
+        workqueue_init(&wq, jobs, jobs * 4, convert_job, data);
 
-static void *parse_xmlnode(xmlNodePtr node, enum xml_entry_type *type)
-{
-        struct xml_htable ht;
-        xmlNodePtr n;
-        JsonObject *jobj;
+        for (i = 0; i < in->nr; i++) {
+                if (workqueue_full(&wq)) {
+                        job = workqueue_pop(&wq);
+                        if (finish_job(job, w) < 0)
+                                failed = 1;
+                }
 
-        if (node == NULL) {
-                *type = ENTRY_TYPE_NULL;
-                return NULL;
+                job = xmalloc(sizeof(struct file_job));
+                job->xmlfile = in->files[i];
+                job->outdir = outdir;
+                job->ret = 0;
+                cstring_init(&job->out.buf, 0);
+                job->out.spill = NULL;
+                workqueue_push(&wq, job);
         }
 
-        /* Initialise a ordered hash table */
-        xml_htable_init(&ht);
-
-        for (n = node; n; n = n->next) {
-                void *val;
-                size_t slen = 0;
-
-                switch(n->type) {
-                case XML_ELEMENT_NODE:
-                        parse_xml_element_node(n, &ht, type);
-                        break;
-                case XML_TEXT_NODE:
-                        val = parse_xml_text_node(n, type, &slen);
-                        if (slen == 0) continue;
-                        xml_htable_free(&ht);
-                        return val;
-                default:
-                        break;
-                }
+        while ((job = workqueue_pop(&wq))) {
+                if (finish_job(job, w) < 0)
+                        failed = 1;
         }
 
-        /* If we've got here, we are returning a json object */
-        *type = ENTRY_TYPE_OBJECT;
-        jobj = xml_htable_to_json_obj(&ht);
+        workqueue_release(&wq);
 
-        /* Free the ordered hash table */
-        xml_htable_free(&ht);
-        memset(&ht, 0, sizeof(struct xml_htable));
+        for (i = 0; i < jobs; i++)
+                converter_release(&workers[i].conv);
+        free(workers);
+        free(data);
 
-        return jobj;
+        return failed ? -1 : 0;
 }
 
-static void parse_xml_tree(xmlDocPtr doc, xmlNodePtr xsdrootin)
-{
-
-        enum xml_entry_type type;
-
-        if (doc == NULL)
-                return;
-
-        if ((doc->type == XML_DOCUMENT_NODE) && (doc->children != NULL)) {
-                void *data;
-                char *json_str = NULL;
-
-                data = parse_xmlnode(doc->children, &type);
-
-                /* Encode our json object into a string */
-                json_str = json_encode((JsonObject *)data);
-                printf("%s\n", json_str);
-                xfree(json_str);
-
-                json_free(data);
-                data = NULL;
-        }
-}
+/* Long options without a short equivalent */
+enum {
+        OPT_SERVE = 256,
+        OPT_CLIENT,
+        OPT_COMPILE_SCHEMA,
+        OPT_XSD_TABLE,
+        OPT_WHITESPACE,
+        OPT_INFER_TYPES,
+        OPT_XSD_TYPES,
+        OPT_XSD_ARRAYS,
+        OPT_BACKEND,
+        OPT_HUGE,
+};
 
 static void usage_and_die(void)
 {
         fprintf(stderr, "xml2json - A program to convert an XML file to JSON!\n");
-        fprintf(stderr, "USAGE: xml2json <xmlfile> -x=<xsdfile>\n");
-        fprintf(stderr, " xsd|x  : use the xsd file to validate!\n");
-        fprintf(stderr, "          (This is optional)\n");
-        fprintf(stderr, " help|h : print this help and exit!\n");
+        fprintf(stderr, "USAGE: xml2json <xmlfile>... -x=<xsdfile>\n");
+        fprintf(stderr, " xsd|x        : use the xsd file to validate!\n");
+        fprintf(stderr, "                (This is optional)\n");
+        fprintf(stderr, " compile-schema: write the element table of the --xsd\n");
+        fprintf(stderr, "                schema to this file and exit\n");
+        fprintf(stderr, " xsd-table    : load the element table from this file,\n");
+        fprintf(stderr, "                written by --compile-schema, instead of\n");
+        fprintf(stderr, "                building it from --xsd\n");
+        fprintf(stderr, " stream|s     : convert while reading, without building\n");
+        fprintf(stderr, "                the document tree in memory\n");
+        fprintf(stderr, " manifest|m   : read the xml files to convert from a\n");
+        fprintf(stderr, "                file, one per line ('-' for stdin)\n");
+        fprintf(stderr, " output-dir|o : write <name>.json for each <name>.xml\n");
+        fprintf(stderr, "                into this directory, instead of one\n");
+        fprintf(stderr, "                line per file to stdout\n");
+        fprintf(stderr, " jobs|j       : convert this many files in parallel\n");
+        fprintf(stderr, " split-at|S   : write one line of JSON for every element\n");
+        fprintf(stderr, "                with this name, converting them on\n");
+        fprintf(stderr, "                --jobs threads\n");
+        fprintf(stderr, " serve        : serve conversion requests on this Unix\n");
+        fprintf(stderr, "                socket, with --jobs threads\n");
+        fprintf(stderr, " client       : convert the files through the server\n");
+        fprintf(stderr, "                on this socket, or print its statistics\n");
+        fprintf(stderr, "                when no files are given\n");
+        fprintf(stderr, " whitespace   : strip (default), trim, collapse or\n");
+        fprintf(stderr, "                preserve the white space in text\n");
+        fprintf(stderr, " infer-types  : write text that is a number, true or\n");
+        fprintf(stderr, "                false as a JSON number or boolean\n");
+        fprintf(stderr, " xsd-types    : write the text of elements with the\n");
+        fprintf(stderr, "                JSON type of their XSD type (number,\n");
+        fprintf(stderr, "                boolean or string)\n");
+        fprintf(stderr, " xsd-arrays   : write elements the XSD lets repeat as\n");
+        fprintf(stderr, "                arrays, even when they appear once\n");
+        fprintf(stderr, " backend      : write the JSON while walking the\n");
+        fprintf(stderr, "                document (emit, the default), or\n");
+        fprintf(stderr, "                through a JSON tree (tree) or a\n");
+        fprintf(stderr, "                flat tape (tape)\n");
+        fprintf(stderr, " huge         : lift libxml2's limits on nesting depth\n");
+        fprintf(stderr, "                and text size, for trusted input only\n");
+        fprintf(stderr, "                (not with --serve)\n");
+        fprintf(stderr, " help|h       : print this help and exit!\n");
         fprintf(stderr, "\n");
 
         exit(1);
 }
 
+
 int main(int argc, char **argv)
 {
-        int fd;
-        struct stat sbinfo;
-        xmlDocPtr doc = NULL;
-        char *base;
         int xml_options = XML_PARSE_COMPACT;
-		xmlNodePtr xsdroot = NULL;
-
-        /* XSD related variables */
-        int ret ;
-        xmlSchemaPtr    schema = NULL;
-        xmlSchemaParserCtxtPtr ctxt;
-        xmlSchemaValidCtxtPtr vctxt;
-        xmlParserCtxtPtr pctxt = NULL;
+        struct converter conv;
+        struct json_writer *w;
+        struct inputs in = { NULL, 0, 0 };
+        size_t i;
+        int failed = 0;
 
         static struct option long_options[] = {
                 {"xsd", required_argument, NULL, 'x'},
+                {"stream", no_argument, NULL, 's'},
+                {"manifest", required_argument, NULL, 'm'},
+                {"output-dir", required_argument, NULL, 'o'},
+                {"jobs", required_argument, NULL, 'j'},
+                {"split-at", required_argument, NULL, 'S'},
+                {"serve", required_argument, NULL, OPT_SERVE},
+                {"client", required_argument, NULL, OPT_CLIENT},
+                {"compile-schema", required_argument, NULL,
+                 OPT_COMPILE_SCHEMA},
+                {"xsd-table", required_argument, NULL, OPT_XSD_TABLE},
+                {"whitespace", required_argument, NULL, OPT_WHITESPACE},
+                {"infer-types", no_argument, NULL, OPT_INFER_TYPES},
+                {"xsd-types", no_argument, NULL, OPT_XSD_TYPES},
+                {"xsd-arrays", no_argument, NULL, OPT_XSD_ARRAYS},
+                {"backend", required_argument, NULL, OPT_BACKEND},
+                {"huge", no_argument, NULL, OPT_HUGE},
                 {"help", no_argument, NULL, 'h'},
                 {NULL, 0, NULL, 0}
         };
         int option;
         int option_index;
         char *xsdfile = NULL;
-        char *xmlfile = NULL;
+        char *compile_schema = NULL;
+        char *xsd_table = NULL;
+        char *manifest = NULL;
+        char *outdir = NULL;
+        char *split_at = NULL;
+        char *serve = NULL;
+        char *client = NULL;
+        int stream = 0;
+        enum ws_mode ws_mode = WS_STRIP;
+        enum convert_backend backend = BACKEND_EMIT;
+        int infer_types = 0;
+        int xsd_types = 0;
+        int xsd_arrays = 0;
+        int huge = 0;
+        long jobs = 1;
 
 #ifdef LINUX
         xml_options |= XML_PARSE_BIG_LINES;
 #endif
 
-        while ((option = getopt_long(argc, argv, "hx:",
+        while ((option = getopt_long(argc, argv, "hj:m:o:S:sx:",
                                     long_options,
                                     &option_index)) != -1) {
                 switch (option) {
                 case 'x':
                         xsdfile = optarg;
                         break;
+                case 's':
+                        stream = 1;
+                        break;
+                case 'm':
+                        manifest = optarg;
+                        break;
+                case 'o':
+                        outdir = optarg;
+                        break;
+                case 'S':
+                        split_at = optarg;
+                        break;
+                case OPT_COMPILE_SCHEMA:
+                        compile_schema = optarg;
+                        break;
+                case OPT_XSD_TABLE:
+                        xsd_table = optarg;
+                        break;
+                case OPT_WHITESPACE:
+                        if (ws_mode_parse(optarg, &ws_mode) < 0)
+                                usage_and_die();
+                        break;
+                case OPT_INFER_TYPES:
+                        infer_types = 1;
+                        break;
+                case OPT_XSD_TYPES:
+                        xsd_types = 1;
+                        break;
+                case OPT_XSD_ARRAYS:
+                        xsd_arrays = 1;
+                        break;
+                case OPT_BACKEND:
+                        if (converter_backend_parse(optarg, &backend) < 0)
+                                usage_and_die();
+                        break;
+                case OPT_HUGE:
+                        huge = 1;
+                        break;
+                case OPT_SERVE:
+                        serve = optarg;
+                        break;
+                case OPT_CLIENT:
+                        client = optarg;
+                        break;
+                case 'j':
+                        jobs = strtol(optarg, NULL, 10);
+                        if (jobs < 1)
+                                usage_and_die();
+                        break;
                 case 'h':
                 case '?':
                 default:
@@ -478,81 +514,135 @@ int main(int argc, char **argv)
                 }
         }
 
-        if (argc - optind != 1) {
-                usage_and_die();
+        for (; optind < argc; optind++)
+                inputs_add(&in, argv[optind]);
+
+        if (manifest && inputs_read_manifest(&in, manifest) < 0) {
+                fprintf(stderr, "%s: %s\n", manifest, strerror(errno));
+                exit(EXIT_FAILURE);
         }
 
-        xmlfile = argv[optind++];
+        if (client) {
+                w = xmalloc(sizeof(struct json_writer));
+                json_writer_init_fd(w, STDOUT_FILENO);
+                if (server_client(client, in.files, in.nr, w) < 0)
+                        failed = 1;
+                if (json_writer_flush(w) < 0)
+                        failed = 1;
+                free(w);
+                exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
 
-        /* mmap the file() */
-        if (stat(xmlfile, &sbinfo) < 0) {
-                perror("stat: ");
+        if (serve && (in.nr || manifest || outdir || split_at || stream ||
+                      huge)) {
+                fprintf(stderr, "--serve only takes --xsd and --jobs\n");
                 exit(EXIT_FAILURE);
         }
 
-        if ((fd = open(xmlfile, O_RDONLY)) < 0) {
-                perror("open: ");
+        /* Conversion isn't recursive, documents nested deeper than
+         * libxml2 allows can be converted once the user trusts them.
+         */
+        if (huge)
+                xml_options |= XML_PARSE_HUGE;
+
+        if (compile_schema && xsdfile == NULL) {
+                fprintf(stderr, "--compile-schema needs --xsd\n");
                 exit(EXIT_FAILURE);
         }
 
-        base = mmap(NULL, sbinfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
-        if (base == (void *) MAP_FAILED){
-                close(fd);
-                perror("mmap: ");
+        if (xsd_types && xsdfile == NULL && xsd_table == NULL) {
+                fprintf(stderr, "--xsd-types needs --xsd or --xsd-table\n");
                 exit(EXIT_FAILURE);
         }
 
-        /* Read into an xmlDocPtr */
-        doc = xmlReadMemory((char *) base, sbinfo.st_size, xmlfile,
-                            NULL, xml_options);
+        if (xsd_arrays && xsdfile == NULL && xsd_table == NULL) {
+                fprintf(stderr, "--xsd-arrays needs --xsd or --xsd-table\n");
+                exit(EXIT_FAILURE);
+        }
 
-        munmap((char *)base, sbinfo.st_size);
-        close(fd);
+        if (in.nr == 0 && manifest == NULL && serve == NULL &&
+            compile_schema == NULL)
+                usage_and_die();
 
-        /* Read the xsd and validate the xml before building XSD and XML/JSON
-           structures */
-        if (xsdfile != NULL) {
-				if ((fd = open(xmlfile, O_RDONLY)) < 0) {
-						perror("open: ");
-						exit(EXIT_FAILURE);
-				} else {
-						close(fd);
-				}
-                ctxt = xmlSchemaNewParserCtxt(xsdfile);
-                xmlSchemaSetParserErrors(ctxt, (xmlSchemaValidityErrorFunc)fprintf,
-                                         (xmlSchemaValidityWarningFunc)fprintf,
-                                         stderr);
-                schema = xmlSchemaParse(ctxt);
-
-                if(schema == NULL) {
-                        exit(EXIT_FAILURE);
+        if (split_at && (stream || xsdfile != NULL)) {
+                fprintf(stderr, "--split-at cannot be used with --stream or --xsd\n");
+                exit(EXIT_FAILURE);
+        }
+
+        xmlInitParser();
+
+        /* The schema and the parser context are shared by all the files */
+        if (converter_init(&conv, xsdfile, compile_schema ? NULL : xsd_table,
+                           xml_options) < 0) {
+                fprintf(stderr, "Failed to initialise the converter\n");
+                exit(EXIT_FAILURE);
+        }
+
+        if (compile_schema) {
+                if (xsd_table_write(conv.table, compile_schema) < 0) {
+                        fprintf(stderr, "%s: %s\n", compile_schema,
+                                strerror(errno));
+                        failed = 1;
                 }
-				xsdroot = schema->doc->children;
-
-                vctxt = xmlSchemaNewValidCtxt(schema);
-                pctxt = xmlSchemaValidCtxtGetParserCtxt(vctxt) ;
-
-                xmlSchemaSetValidErrors(vctxt, (xmlSchemaValidityErrorFunc)fprintf,
-                                        (xmlSchemaValidityWarningFunc) fprintf,
-                                        stderr);
-                ret = xmlSchemaValidateDoc(vctxt, doc);
-                if (ret == 0) {
-                        printf("%s validates\n", xmlfile);
-                } else if (ret > 0) {
-                        printf("%s fails to validate\n", xmlfile);
-                } else {
-                        printf("%s validation generated an internal error\n", xmlfile);
+                converter_release(&conv);
+                exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+        conv.stream = stream;
+        conv.backend = backend;
+        conv.ws_mode = ws_mode;
+        conv.infer_types = infer_types;
+        conv.xsd_types = xsd_types;
+        conv.xsd_arrays = xsd_arrays;
+        conv.verror = print_validity_error;
+
+        if (serve) {
+                server_run(&conv, serve, jobs);
+                exit(EXIT_FAILURE);
+        }
+
+        w = xmalloc(sizeof(struct json_writer));
+        json_writer_init_fd(w, STDOUT_FILENO);
+
+        if (jobs > 1 && in.nr > 1 && !split_at) {
+                if (convert_parallel(&conv, &in, outdir, jobs, w) < 0)
+                        failed = 1;
+        } else {
+                struct batch_buffer out = { CSTRING_INIT, NULL };
+
+                for (i = 0; i < in.nr; i++) {
+                        int ret;
+
+                        /* A single document goes straight out, that is
+                         * what --stream of a large file is for.
+                         */
+                        if (outdir)
+                                ret = convert_to_dir(&conv, in.files[i],
+                                                     split_at, jobs,
+                                                     outdir, w);
+                        else if (in.nr > 1)
+                                ret = convert_buffered(&conv, in.files[i],
+                                                       split_at, jobs, &out,
+                                                       w);
+                        else
+                                ret = convert_file(&conv, in.files[i],
+                                                   split_at, jobs, w);
+
+                        if (ret < 0) {
+                                fprintf(stderr, "%s: failed to convert\n",
+                                        in.files[i]);
+                                failed = 1;
+                        }
                 }
+                cstring_release(&out.buf);
         }
 
-		if(xsdroot != NULL)  {
-				walkXsdSchema(xsdroot);
-				print_array_elements();
-				xsdschemafree();
-		}
-        parse_xml_tree(doc, xsdfile ? xsdroot : NULL);
+        if (!outdir && json_writer_flush(w) < 0) {
+                perror("write: ");
+                failed = 1;
+        }
 
-        xmlFreeDoc(doc);
+        free(w);
+        converter_release(&conv);
 
-        exit(EXIT_SUCCESS);
+        exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
 }
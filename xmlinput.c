@@ -0,0 +1,346 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * xmlinput - read XML from pipes and from files too large to parse in one piece.
+ */
+
+#include "xmlinput.h"
+
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Double buffered input: the reader thread fills buffer `i % 2` while the
+ * parser works on the other one.
+ */
+struct input_buffer {
+        char *data;
+        size_t len;
+        int full;
+};
+
+struct chunk_reader {
+        int fd;
+        int error;              /* errno of a failed read() */
+
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        struct input_buffer bufs[2];
+};
+
+/* Fill `buf` from the fd, returns the number of bytes read, 0 at the end
+ * of the input and -1 on errors.
+ */
+static ssize_t read_chunk(int fd, char *buf, size_t size)
+{
+        size_t len = 0;
+
+        while (len < size) {
+                ssize_t n = read(fd, buf + len, size - len);
+
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                if (n == 0)
+                        break;
+                len += n;
+        }
+
+        return len;
+}
+
+static int write_full(int fd, const char *buf, size_t len)
+{
+        while (len) {
+                ssize_t n = write(fd, buf, len);
+
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                buf += n;
+                len -= n;
+        }
+
+        return 0;
+}
+
+static void *chunk_reader_main(void *data)
+{
+        struct chunk_reader *cr = data;
+        unsigned int i;
+
+        for (i = 0; ; i++) {
+                struct input_buffer *b = &cr->bufs[i % 2];
+                ssize_t n;
+
+                pthread_mutex_lock(&cr->lock);
+                while (b->full)
+                        pthread_cond_wait(&cr->cond, &cr->lock);
+                pthread_mutex_unlock(&cr->lock);
+
+                n = read_chunk(cr->fd, b->data, XML_INPUT_CHUNK_SIZE);
+
+                pthread_mutex_lock(&cr->lock);
+                if (n < 0) {
+                        cr->error = errno;
+                        n = 0;
+                }
+                b->len = n;
+                b->full = 1;
+                pthread_cond_broadcast(&cr->cond);
+                pthread_mutex_unlock(&cr->lock);
+
+                if (n == 0)
+                        break;
+        }
+
+        return NULL;
+}
+
+/* Wait for buffer `i` to be filled. Returns it, with `len` 0 at the end of
+ * the input.
+ */
+static struct input_buffer *chunk_reader_get(struct chunk_reader *cr,
+                                             unsigned int i)
+{
+        struct input_buffer *b = &cr->bufs[i % 2];
+
+        pthread_mutex_lock(&cr->lock);
+        while (!b->full)
+                pthread_cond_wait(&cr->cond, &cr->lock);
+        pthread_mutex_unlock(&cr->lock);
+
+        return b;
+}
+
+/* Hand buffer `b` back to the reader thread */
+static void chunk_reader_put(struct chunk_reader *cr, struct input_buffer *b)
+{
+        pthread_mutex_lock(&cr->lock);
+        b->full = 0;
+        pthread_cond_broadcast(&cr->cond);
+        pthread_mutex_unlock(&cr->lock);
+}
+
+/* Take the parsed document out of a push parser context */
+static xmlDocPtr push_parser_doc(xmlParserCtxtPtr ctxt, int ok)
+{
+        xmlDocPtr doc = NULL;
+
+        if (ctxt->wellFormed && ok)
+                doc = ctxt->myDoc;
+        else if (ctxt->myDoc)
+                xmlFreeDoc(ctxt->myDoc);
+        ctxt->myDoc = NULL;
+
+        return doc;
+}
+
+/*
+ * Public Functions
+ */
+
+int xml_input_is_stdin(const char *path)
+{
+        return strcmp(path, "-") == 0;
+}
+
+xmlDocPtr xml_read_fd(xmlParserCtxtPtr ctxt, int fd, const char *name,
+                      int options)
+{
+        struct chunk_reader cr;
+        struct input_buffer *b;
+        pthread_t thread;
+        xmlDocPtr doc = NULL;
+        unsigned int i;
+        int ret, last;
+
+        memset(&cr, 0, sizeof(struct chunk_reader));
+        cr.fd = fd;
+        pthread_mutex_init(&cr.lock, NULL);
+        pthread_cond_init(&cr.cond, NULL);
+        cr.bufs[0].data = xmalloc(XML_INPUT_CHUNK_SIZE);
+        cr.bufs[1].data = xmalloc(XML_INPUT_CHUNK_SIZE);
+
+        ret = pthread_create(&thread, NULL, chunk_reader_main, &cr);
+        if (ret) {
+                fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+                exit(EXIT_FAILURE);
+        }
+
+        xmlCtxtResetPush(ctxt, NULL, 0, name, NULL);
+        xmlCtxtUseOptions(ctxt, options);
+
+        for (i = 0; ; i++) {
+                b = chunk_reader_get(&cr, i);
+                last = (b->len == 0);
+
+                ret = xmlParseChunk(ctxt, b->data, b->len, last);
+                chunk_reader_put(&cr, b);
+
+                if (last || ret != XML_ERR_OK)
+                        break;
+        }
+
+        /* On parse errors, drain the input so the reader thread finishes */
+        while (!last) {
+                b = chunk_reader_get(&cr, ++i);
+                last = (b->len == 0);
+                chunk_reader_put(&cr, b);
+        }
+
+        pthread_join(thread, NULL);
+
+        if (cr.error)
+                fprintf(stderr, "%s: %s\n", name, strerror(cr.error));
+
+        doc = push_parser_doc(ctxt, !cr.error);
+
+        pthread_cond_destroy(&cr.cond);
+        pthread_mutex_destroy(&cr.lock);
+        free(cr.bufs[0].data);
+        free(cr.bufs[1].data);
+
+        return doc;
+}
+
+xmlDocPtr xml_read_mapped(xmlParserCtxtPtr ctxt, int fd, size_t size,
+                          const char *name, int options)
+{
+        long pagesize = sysconf(_SC_PAGESIZE);
+        size_t off = 0, dropped = 0;
+        char *base;
+        int ret = XML_ERR_OK;
+
+        base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base == (void *) MAP_FAILED) {
+                perror("mmap: ");
+                return NULL;
+        }
+
+        madvise(base, size, MADV_SEQUENTIAL);
+
+        xmlCtxtResetPush(ctxt, NULL, 0, name, NULL);
+        xmlCtxtUseOptions(ctxt, options);
+
+        while (off < size && ret == XML_ERR_OK) {
+                size_t len = size - off;
+                size_t next, keep;
+
+                if (len > XML_INPUT_MAP_CHUNK_SIZE)
+                        len = XML_INPUT_MAP_CHUNK_SIZE;
+
+                /* Read ahead the chunk after this one */
+                next = off + len;
+                if (next < size) {
+                        size_t ahead = size - next;
+
+                        if (ahead > XML_INPUT_MAP_CHUNK_SIZE)
+                                ahead = XML_INPUT_MAP_CHUNK_SIZE;
+                        madvise(base + (next & ~(pagesize - 1)),
+                                ahead + (next & (pagesize - 1)),
+                                MADV_WILLNEED);
+                }
+
+                ret = xmlParseChunk(ctxt, base + off, len, 0);
+                off = next;
+
+                /* The parser copied what it was given, drop those pages
+                 * from the mapping and from the page cache.
+                 */
+                keep = off & ~(pagesize - 1);
+                if (keep > dropped) {
+                        madvise(base + dropped, keep - dropped, MADV_DONTNEED);
+                        posix_fadvise(fd, dropped, keep - dropped,
+                                      POSIX_FADV_DONTNEED);
+                        dropped = keep;
+                }
+        }
+
+        if (ret == XML_ERR_OK)
+                xmlParseChunk(ctxt, NULL, 0, 1);
+
+        munmap(base, size);
+
+        return push_parser_doc(ctxt, 1);
+}
+
+xmlDocPtr xml_read_memory(xmlParserCtxtPtr ctxt, const char *buf,
+                          size_t size, const char *name, int options)
+{
+        size_t off;
+        int ret = XML_ERR_OK;
+
+        if (size <= XML_INPUT_LARGE_FILE)
+                return xmlCtxtReadMemory(ctxt, buf, size, name, NULL, options);
+
+        xmlCtxtResetPush(ctxt, NULL, 0, name, NULL);
+        xmlCtxtUseOptions(ctxt, options);
+
+        for (off = 0; off < size && ret == XML_ERR_OK; ) {
+                size_t len = size - off;
+
+                if (len > XML_INPUT_MAP_CHUNK_SIZE)
+                        len = XML_INPUT_MAP_CHUNK_SIZE;
+                ret = xmlParseChunk(ctxt, buf + off, len, 0);
+                off += len;
+        }
+
+        if (ret == XML_ERR_OK)
+                xmlParseChunk(ctxt, NULL, 0, 1);
+
+        return push_parser_doc(ctxt, 1);
+}
+
+int xml_input_rewindable(int fd)
+{
+        FILE *tmp;
+        char *buf;
+        ssize_t n;
+        int out;
+
+        if (lseek(fd, 0, SEEK_CUR) >= 0)
+                return fd;
+
+        /* The file is unlinked, it goes away with the descriptor */
+        tmp = tmpfile();
+        if (tmp == NULL)
+                return -1;
+        out = dup(fileno(tmp));
+        fclose(tmp);
+        if (out < 0)
+                return -1;
+
+        buf = xmalloc(XML_INPUT_CHUNK_SIZE);
+        while ((n = read_chunk(fd, buf, XML_INPUT_CHUNK_SIZE)) > 0) {
+                if (write_full(out, buf, n) < 0) {
+                        n = -1;
+                        break;
+                }
+        }
+        free(buf);
+
+        if (n < 0 || lseek(out, 0, SEEK_SET) < 0) {
+                close(out);
+                return -1;
+        }
+
+        return out;
+}
+
+xmlTextReaderPtr xml_reader_for_path(const char *path, int options)
+{
+        if (xml_input_is_stdin(path))
+                return xmlReaderForFd(STDIN_FILENO, "-", NULL, options);
+
+        return xmlReaderForFile(path, NULL, options);
+}
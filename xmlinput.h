@@ -0,0 +1,83 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * xmlinput - read XML from pipes and from files too large to parse in one piece.
+ */
+
+#ifndef XML2JSON_XMLINPUT_H
+#define XML2JSON_XMLINPUT_H
+
+#include <limits.h>
+#include <stddef.h>
+
+#include <libxml/parser.h>
+#include <libxml/xmlreader.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size of the chunks handed to the push parser */
+#define XML_INPUT_CHUNK_SIZE (256 * 1024)
+
+/* Files larger than this are not handed to libxml2 in one piece, as
+ * xmlReadMemory() and friends take an int size.
+ */
+#ifndef XML_INPUT_LARGE_FILE
+#define XML_INPUT_LARGE_FILE ((size_t)INT_MAX)
+#endif
+
+/* Chunks the push parser gets from a mapped large file */
+#define XML_INPUT_MAP_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* xml_input_is_stdin():
+ * Returns true if `path` names the standard input, i.e. it is "-".
+ */
+extern int xml_input_is_stdin(const char *path);
+
+/* xml_read_fd():
+ * Parse a document from `fd`, which may be a pipe, with `ctxt` turned into
+ * a push parser. A reader thread fills one of two buffers while the other
+ * one is being parsed, so waiting for input overlaps with parsing.
+ * `name` is only used in error messages. Returns NULL if the document is
+ * not well formed or could not be read.
+ */
+extern xmlDocPtr xml_read_fd(xmlParserCtxtPtr ctxt, int fd, const char *name,
+                             int options);
+
+/* xml_read_mapped():
+ * Parse a large regular file of `size` bytes from `fd`. The file is mapped
+ * and fed to `ctxt`, as a push parser, in chunks. The kernel is told that
+ * the mapping is read sequentially, the next chunk is read ahead and the
+ * pages already parsed are dropped, so memory use stays flat however large
+ * the file is. Returns NULL if the document is not well formed.
+ */
+extern xmlDocPtr xml_read_mapped(xmlParserCtxtPtr ctxt, int fd, size_t size,
+                                 const char *name, int options);
+
+/* xml_read_memory():
+ * Parse `size` bytes at `buf` with `ctxt`. Buffers larger than what
+ * xmlCtxtReadMemory() accepts are fed to it as a push parser in chunks.
+ * Returns NULL if the document is not well formed.
+ */
+extern xmlDocPtr xml_read_memory(xmlParserCtxtPtr ctxt, const char *buf,
+                                 size_t size, const char *name, int options);
+
+/* xml_input_rewindable():
+ * Returns a descriptor from which the input of `fd` can be read again by
+ * seeking back to the offset it was at: `fd` itself if it can seek, or a
+ * temporary file all of the input was copied to, which the caller closes.
+ * Returns -1 if the input could not be copied.
+ */
+extern int xml_input_rewindable(int fd);
+
+/* xml_reader_for_path():
+ * Create an xmlTextReader for `path`, reading stdin for "-".
+ */
+extern xmlTextReaderPtr xml_reader_for_path(const char *path, int options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_XMLINPUT_H */
@@ -0,0 +1,171 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * xmlsplit - convert the records of a document into NDJSON.
+ */
+
+#include "xmlsplit.h"
+
+#include "cstring.h"
+#include "util.h"
+#include "xmlinput.h"
+#include "workqueue.h"
+
+#include <string.h>
+
+#include <libxml/dict.h>
+#include <libxml/xmlreader.h>
+
+/* Records in flight per worker thread */
+#define SPLIT_WINDOW_PER_JOB 64
+
+struct record_job {
+        xmlDocPtr doc;
+        cstring out;
+};
+
+struct record_worker {
+        struct converter conv;
+        struct json_writer w;
+};
+
+static void convert_record(void *worker, void *data)
+{
+        struct record_worker *rw = worker;
+        struct record_job *job = data;
+
+        json_writer_init_cstring(&rw->w, &job->out);
+        converter_convert_doc(&rw->conv, job->doc, &rw->w);
+        json_writer_flush(&rw->w);
+}
+
+/* Copy the subtree the reader is positioned on into a document of its own.
+ * The record shares the reader's dictionary, so names are not copied. The
+ * dictionary is only ever modified by the reading thread, and records are
+ * freed by it too.
+ */
+static struct record_job *new_record_job(xmlTextReaderPtr reader)
+{
+        struct record_job *job;
+        xmlNodePtr node, copy;
+        xmlDocPtr doc;
+
+        node = xmlTextReaderExpand(reader);
+        if (node == NULL)
+                return NULL;
+
+        doc = xmlNewDoc((const xmlChar *)"1.0");
+        doc->dict = xmlTextReaderCurrentDoc(reader)->dict;
+        if (doc->dict)
+                xmlDictReference(doc->dict);
+
+        copy = xmlDocCopyNode(node, doc, 1);
+        xmlDocSetRootElement(doc, copy);
+
+        job = xmalloc(sizeof(struct record_job));
+        job->doc = doc;
+        cstring_init(&job->out, 0);
+
+        return job;
+}
+
+static void finish_record_job(struct record_job *job, struct json_writer *w)
+{
+        json_writer_add(w, job->out.buf, job->out.len);
+        cstring_release(&job->out);
+        xmlFreeDoc(job->doc);
+        free(job);
+}
+
+static int split_run(xmlTextReaderPtr reader, const xmlChar *name,
+                     struct workqueue *wq, struct record_worker *single,
+                     struct json_writer *w)
+{
+        struct record_job *job;
+        int ret;
+
+        ret = xmlTextReaderRead(reader);
+        while (ret == 1) {
+                if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT ||
+                    !xmlStrEqual(xmlTextReaderConstLocalName(reader), name)) {
+                        ret = xmlTextReaderRead(reader);
+                        continue;
+                }
+
+                job = new_record_job(reader);
+                if (job == NULL) {
+                        ret = -1;
+                        break;
+                }
+
+                if (wq) {
+                        if (workqueue_full(wq))
+                                finish_record_job(workqueue_pop(wq), w);
+                        workqueue_push(wq, job);
+                } else {
+                        convert_record(single, job);
+                        finish_record_job(job, w);
+                }
+
+                /* Skip the record's subtree, letting the reader free it */
+                ret = xmlTextReaderNext(reader);
+        }
+
+        if (wq) {
+                while ((job = workqueue_pop(wq)))
+                        finish_record_job(job, w);
+        }
+
+        return ret == 0 ? 0 : -1;
+}
+
+/*
+ * Public Functions
+ */
+
+int xml_split_convert(struct converter *conv, const char *filename,
+                      const char *name, size_t jobs, struct json_writer *w)
+{
+        xmlTextReaderPtr reader;
+        struct record_worker *workers;
+        struct workqueue wq;
+        void **data;
+        size_t i;
+        int ret;
+
+        reader = xml_reader_for_path(filename, conv->xml_options);
+        if (reader == NULL)
+                return -1;
+
+        if (jobs < 1)
+                jobs = 1;
+
+        workers = xcalloc(jobs, sizeof(struct record_worker));
+        data = xcalloc(jobs, sizeof(void *));
+        for (i = 0; i < jobs; i++) {
+                if (converter_clone(&workers[i].conv, conv) < 0) {
+                        fprintf(stderr, "Failed to initialise the converter\n");
+                        exit(EXIT_FAILURE);
+                }
+                data[i] = &workers[i];
+        }
+
+        if (jobs > 1) {
+                workqueue_init(&wq, jobs, jobs * SPLIT_WINDOW_PER_JOB,
+                               convert_record, data);
+                ret = split_run(reader, (const xmlChar *)name, &wq, NULL, w);
+                workqueue_release(&wq);
+        } else {
+                ret = split_run(reader, (const xmlChar *)name, NULL,
+                                &workers[0], w);
+        }
+
+        for (i = 0; i < jobs; i++)
+                converter_release(&workers[i].conv);
+        free(workers);
+        free(data);
+
+        xmlFreeTextReader(reader);
+
+        return ret;
+}
@@ -0,0 +1,38 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * xmlsplit - convert the records of a document into NDJSON.
+ */
+
+#ifndef XML2JSON_XMLSPLIT_H
+#define XML2JSON_XMLSPLIT_H
+
+#include "converter.h"
+#include "json.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* xml_split_convert():
+ * Read `filename` with an xmlTextReader and cut it into records at every
+ * element named `name`; elements nested in a record belong to it. Each
+ * record is converted as if it were a document of its own and written to
+ * `w` as one line of JSON, in input order.
+ *
+ * With `jobs` > 1, records are converted on that many threads, each using
+ * a clone of `conv`. Only a bounded number of records is held in memory.
+ *
+ * Returns 0 on success and -1 if the document could not be parsed.
+ */
+extern int xml_split_convert(struct converter *conv, const char *filename,
+                             const char *name, size_t jobs,
+                             struct json_writer *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_XMLSPLIT_H */
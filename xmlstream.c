@@ -0,0 +1,677 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * xmlstream - convert XML to JSON while the input is being read.
+ */
+
+#include "xmlstream.h"
+
+#include "cstring.h"
+#include "jsonescape.h"
+#include "scalar.h"
+#include "util.h"
+#include "whitespace.h"
+#include "xmlinput.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libxml/SAX2.h>
+#include <libxml/xmlreader.h>
+
+/* What the first pass found out about an element, two bits per element
+ * in document order.
+ */
+#define SHAPE_REPEATS 1         /* the next sibling element has its name */
+#define SHAPE_TEXT 2            /* it has text, which is its value */
+
+struct stream_shape {
+        uint8_t *bits;
+        size_t nr;              /* elements seen */
+        size_t alloc;
+};
+
+/* An element open during the first pass */
+struct shape_level {
+        size_t element;         /* index of the element */
+        const xmlChar *last;    /* name of its last child... */
+        size_t last_element;    /* ...and the child's index */
+};
+
+struct shape_scan {
+        xmlParserCtxtPtr ctxt;
+        struct stream_shape *shape;
+        struct shape_level *levels;
+        size_t nr_levels;
+        size_t alloc_levels;
+};
+
+/* State of the value of an open element */
+enum frame_state {
+        FRAME_EMPTY,            /* nothing seen yet */
+        FRAME_BLANK,            /* only whitespace text seen */
+        FRAME_OBJECT,           /* '{' written, members follow */
+        FRAME_TEXT,             /* value was a string, ignore the rest */
+        FRAME_SKIP,             /* in an element whose value is text */
+};
+
+/* State of the current run of same named children */
+enum run_state {
+        RUN_NONE,
+        RUN_ARRAY,              /* '[' written, values follow */
+        RUN_SINGLE,             /* value written out, it can't repeat */
+};
+
+struct stream_frame {
+        enum frame_state state;
+        int text_value;         /* the element's text is its value */
+        const xmlChar *name;    /* NULL for the document */
+        const struct xsd_element *decl; /* from the schema, or NULL */
+        const xmlChar *child_name;      /* last child looked up... */
+        const struct xsd_element *child_decl;   /* ...and its declaration */
+        cstring attrs;          /* rendered attribute members */
+        unsigned int members;   /* members written so far */
+
+        const xmlChar *run;     /* name of the current run of children */
+        enum run_state run_state;
+};
+
+struct xml_stream {
+        xmlTextReaderPtr reader;
+        struct json_writer *out;
+        struct stream_shape shape;
+        size_t element;         /* index of the next element */
+        enum ws_mode ws;
+        int infer_types;
+        const struct xsd_table *table;  /* NULL unless the schema is used */
+        int xsd_types;
+        int xsd_arrays;
+
+        struct stream_frame *frames;
+        size_t nr_frames;
+        size_t alloc_frames;
+        size_t init_frames;     /* frames with initialised buffers */
+
+        /* scratch space for rendering attributes */
+        cstring *attrs;
+        size_t nr_attrs;
+        size_t alloc_attrs;
+};
+
+static inline void stream_puts(struct xml_stream *st, const char *s)
+{
+        json_writer_add(st->out, s, strlen(s));
+}
+
+static void shape_set(struct stream_shape *shape, size_t element,
+                      unsigned int bits)
+{
+        shape->bits[element / 4] |= bits << (element % 4 * 2);
+}
+
+static unsigned int shape_get(const struct stream_shape *shape,
+                              size_t element)
+{
+        if (element >= shape->nr)
+                return 0;
+
+        return (shape->bits[element / 4] >> (element % 4 * 2)) & 3;
+}
+
+/* Index a new element, returns its index */
+static size_t shape_add(struct stream_shape *shape)
+{
+        if (shape->nr % 4 == 0) {
+                ALLOC_GROW(shape->bits, shape->nr / 4 + 1, shape->alloc);
+                shape->bits[shape->nr / 4] = 0;
+        }
+
+        return shape->nr++;
+}
+
+/* The scan state, or NULL in the content of an entity, which the reader
+ * has as a reference unless entities are substituted. Depending on the
+ * version of libxml2, the content is parsed with another context or as
+ * another input of this one.
+ */
+static struct shape_scan *scan_get(void *ctx)
+{
+        xmlParserCtxtPtr ctxt = ctx;
+        struct shape_scan *scan = ctxt->_private;
+
+        if (scan == NULL)
+                return NULL;
+        if ((ctxt != scan->ctxt || ctxt->inputNr > 1) &&
+            !scan->ctxt->replaceEntities)
+                return NULL;
+
+        return scan;
+}
+
+static void scan_start(void *ctx, const xmlChar *name,
+                       const xmlChar *prefix, const xmlChar *uri,
+                       int nr_namespaces, const xmlChar **namespaces,
+                       int nr_attributes, int nr_defaulted,
+                       const xmlChar **attributes)
+{
+        struct shape_scan *scan = scan_get(ctx);
+        struct shape_level *l;
+        size_t e;
+
+        if (scan == NULL)
+                return;
+
+        l = &scan->levels[scan->nr_levels - 1];
+        e = shape_add(scan->shape);
+        if (l->last == name)
+                shape_set(scan->shape, l->last_element, SHAPE_REPEATS);
+        l->last = name;
+        l->last_element = e;
+
+        ALLOC_GROW(scan->levels, scan->nr_levels + 1, scan->alloc_levels);
+        l = &scan->levels[scan->nr_levels++];
+        l->element = e;
+        l->last = NULL;
+}
+
+static void scan_end(void *ctx, const xmlChar *name, const xmlChar *prefix,
+                     const xmlChar *uri)
+{
+        struct shape_scan *scan = scan_get(ctx);
+
+        if (scan)
+                scan->nr_levels--;
+}
+
+static void scan_text(void *ctx, const xmlChar *text, int len)
+{
+        struct shape_scan *scan = scan_get(ctx);
+
+        if (scan && scan->nr_levels > 1 &&
+            !ws_is_blank((const char *)text, len))
+                shape_set(scan->shape,
+                          scan->levels[scan->nr_levels - 1].element,
+                          SHAPE_TEXT);
+}
+
+static void scan_ignore(void *ctx, const xmlChar *data, int len)
+{
+}
+
+static void scan_reference(void *ctx, const xmlChar *name)
+{
+}
+
+static void scan_error(void *data, convert_error_ptr error)
+{
+}
+
+/* The first pass: parse the document from `fd` without building it, and
+ * find out for each element whether it starts a run of siblings of the
+ * same name, which is then an array, and whether it has text, which is
+ * then its value and hides its children. That is all the DOM conversion
+ * looks ahead for, so the second pass can write each value as it is read.
+ * The default SAX2 handlers are kept for the DTD, so entities are
+ * resolved as they are for the reader. Errors are left for the second
+ * pass to report.
+ */
+static void shape_scan(struct stream_shape *shape, int fd, const char *name,
+                       int options)
+{
+        struct shape_scan scan;
+        xmlParserCtxtPtr ctxt;
+        xmlSAXHandler sax;
+        xmlDocPtr doc;
+
+        xmlSAXVersion(&sax, 2);
+        sax.startElementNs = scan_start;
+        sax.endElementNs = scan_end;
+        sax.characters = scan_text;
+        sax.ignorableWhitespace = scan_ignore;
+        sax.cdataBlock = scan_ignore;
+        sax.comment = NULL;
+        sax.processingInstruction = NULL;
+        sax.reference = scan_reference;
+        sax.serror = scan_error;
+
+        memset(&scan, 0, sizeof(struct shape_scan));
+        scan.shape = shape;
+        ALLOC_GROW(scan.levels, 1, scan.alloc_levels);
+        memset(&scan.levels[0], 0, sizeof(struct shape_level));
+        scan.nr_levels = 1;
+
+        ctxt = xmlCreatePushParserCtxt(&sax, NULL, NULL, 0, name);
+        if (ctxt) {
+                scan.ctxt = ctxt;
+                ctxt->_private = &scan;
+                doc = xml_read_fd(ctxt, fd, name, options);
+                if (doc)
+                        xmlFreeDoc(doc);
+                xmlFreeParserCtxt(ctxt);
+        }
+
+        free(scan.levels);
+}
+
+/* Render `"key":` into `out`, prefixing the key with `prefix` if given */
+static void render_key(cstring *out, const char *prefix, const xmlChar *key)
+{
+        cstring_addch(out, '"');
+        if (prefix)
+                cstring_addstr(out, prefix);
+        cstring_addstr(out, (const char *)key);
+        cstring_addstr(out, "\":");
+}
+
+/* Render a JSON string from `text`, normalising the XML white space like
+ * the DOM conversion does. Text of an element declared by `decl` is
+ * written as the type of the declaration, and other text as a number or
+ * boolean if it is one and types are inferred. Returns 0 if nothing was
+ * left after normalisation.
+ */
+static int render_text(struct xml_stream *st, cstring *out,
+                       const xmlChar *text, const struct xsd_element *decl)
+{
+        size_t len = text ? strlen((const char *)text) : 0;
+        enum scalar_type type = SCALAR_STRING;
+        size_t first;
+        char *p;
+
+        if (len == 0)
+                return 0;
+
+        /* Typed values may grow by a byte, or become "false" */
+        cstring_grow(out, len + 6);
+        p = out->buf + out->len;
+        len = ws_normalize(p + 1, (const char *)text, len, st->ws);
+        if (len == 0)
+                return 0;
+
+        if (decl && st->xsd_types)
+                type = xsd_value_to_json(xsd_table_value_type(st->table, decl),
+                                         p + 1, &len);
+        else if (st->infer_types)
+                type = scalar_classify(p + 1, len);
+
+        if (type != SCALAR_STRING) {
+                memmove(p, p + 1, len);
+                cstring_setlen(out, out->len + len);
+                return 1;
+        }
+
+        out->buf[out->len] = '"';
+        first = json_escape_find(p + 1, len);
+        if (first < len) {
+                /* The escaped text is written over the normalised one */
+                char *rest = xmalloc(len - first);
+
+                memcpy(rest, p + 1 + first, len - first);
+                cstring_setlen(out, out->len + 1 + first);
+                json_escape_cstring(out, rest, len - first);
+                free(rest);
+        } else {
+                cstring_setlen(out, out->len + 1 + len);
+        }
+        cstring_addch(out, '"');
+
+        return 1;
+}
+
+static void write_member_key(struct xml_stream *st, struct stream_frame *f,
+                             const xmlChar *key)
+{
+        if (f->members++)
+                json_writer_addch(st->out, ',');
+        json_writer_addch(st->out, '"');
+        stream_puts(st, (const char *)key);
+        json_writer_add(st->out, "\":", 2);
+}
+
+static void open_object(struct xml_stream *st, struct stream_frame *f)
+{
+        json_writer_addch(st->out, '{');
+        if (f->attrs.len) {
+                json_writer_add(st->out, f->attrs.buf, f->attrs.len);
+                f->members = 1;
+        }
+        f->state = FRAME_OBJECT;
+}
+
+/* Close the current run of children */
+static void flush_run(struct xml_stream *st, struct stream_frame *f)
+{
+        switch (f->run_state) {
+        case RUN_ARRAY:
+                json_writer_addch(st->out, ']');
+                break;
+        case RUN_SINGLE:
+        case RUN_NONE:
+        default:
+                break;
+        }
+
+        f->run = NULL;
+        f->run_state = RUN_NONE;
+}
+
+static struct stream_frame *push_frame(struct xml_stream *st)
+{
+        struct stream_frame *f;
+
+        ALLOC_GROW(st->frames, st->nr_frames + 1, st->alloc_frames);
+        f = &st->frames[st->nr_frames++];
+
+        /* Frames are reused, keep the buffers that were allocated */
+        if (st->nr_frames > st->init_frames) {
+                cstring_init(&f->attrs, 0);
+                st->init_frames = st->nr_frames;
+        }
+
+        f->state = FRAME_EMPTY;
+        f->text_value = 0;
+        f->members = 0;
+        f->run = NULL;
+        f->run_state = RUN_NONE;
+        f->name = NULL;
+        f->decl = NULL;
+        f->child_name = NULL;
+        cstring_setlen(&f->attrs, 0);
+
+        return f;
+}
+
+/* Collect the attributes of the current element into `f->attrs`. The DOM
+ * conversion prepends attributes, so they are rendered in reverse order.
+ */
+static void read_attributes(struct xml_stream *st, struct stream_frame *f)
+{
+        xmlTextReaderPtr reader = st->reader;
+        size_t i;
+
+        st->nr_attrs = 0;
+
+        if (xmlTextReaderMoveToFirstAttribute(reader) != 1)
+                return;
+
+        do {
+                cstring *a;
+
+                if (xmlTextReaderIsNamespaceDecl(reader) == 1)
+                        continue;
+
+                ALLOC_GROW(st->attrs, st->nr_attrs + 1, st->alloc_attrs);
+                a = &st->attrs[st->nr_attrs];
+                cstring_init(a, 0);
+
+                render_key(a, "@", xmlTextReaderConstLocalName(reader));
+                if (!render_text(st, a, xmlTextReaderConstValue(reader),
+                                 NULL)) {
+                        cstring_release(a);
+                        continue;
+                }
+                st->nr_attrs++;
+        } while (xmlTextReaderMoveToNextAttribute(reader) == 1);
+
+        xmlTextReaderMoveToElement(reader);
+
+        for (i = st->nr_attrs; i > 0; i--) {
+                cstring *a = &st->attrs[i - 1];
+
+                if (f->attrs.len)
+                        cstring_addch(&f->attrs, ',');
+                cstring_add(&f->attrs, a->buf, a->len);
+                cstring_release(a);
+        }
+}
+
+/* Write the value of the element in `f`, once all its content was seen */
+static void finish_frame(struct xml_stream *st, struct stream_frame *f)
+{
+        switch (f->state) {
+        case FRAME_EMPTY:
+                if (f->attrs.len) {
+                        open_object(st, f);
+                        json_writer_addch(st->out, '}');
+                } else {
+                        json_writer_add(st->out, "null", 4);
+                }
+                break;
+        case FRAME_BLANK:
+                open_object(st, f);
+                json_writer_addch(st->out, '}');
+                break;
+        case FRAME_OBJECT:
+                flush_run(st, f);
+                json_writer_addch(st->out, '}');
+                break;
+        case FRAME_TEXT:
+        case FRAME_SKIP:
+        default:
+                break;
+        }
+
+        st->nr_frames--;
+}
+
+/* A child element declared by `decl` starts in `f`, write its key. Runs
+ * of children the first pass saw repeat are arrays.
+ */
+static void start_child(struct xml_stream *st, struct stream_frame *f,
+                        const xmlChar *name, const struct xsd_element *decl,
+                        unsigned int shape)
+{
+        if (f->state != FRAME_OBJECT)
+                open_object(st, f);
+
+        if (f->run_state == RUN_ARRAY && xmlStrEqual(f->run, name)) {
+                json_writer_addch(st->out, ',');
+                return;
+        }
+
+        flush_run(st, f);
+        f->run = name;
+        write_member_key(st, f, name);
+
+        /* Elements the schema lets repeat are arrays from the first one */
+        if ((shape & SHAPE_REPEATS) ||
+            (st->xsd_arrays && decl && decl->array != SINGLE_ELEMENT)) {
+                json_writer_addch(st->out, '[');
+                f->run_state = RUN_ARRAY;
+        } else {
+                f->run_state = RUN_SINGLE;
+        }
+}
+
+static void handle_text(struct xml_stream *st, struct stream_frame *f)
+{
+        cstring text;
+
+        if (!f->text_value || f->state == FRAME_TEXT)
+                return;
+
+        cstring_init(&text, 0);
+        if (!render_text(st, &text, xmlTextReaderConstValue(st->reader),
+                         f->decl)) {
+                cstring_release(&text);
+                return;
+        }
+
+        if (f->attrs.len) {
+                open_object(st, f);
+                stream_puts(st, ",\"#text\":");
+                json_writer_add(st->out, text.buf, text.len);
+                json_writer_addch(st->out, '}');
+        } else {
+                json_writer_add(st->out, text.buf, text.len);
+        }
+
+        f->state = FRAME_TEXT;
+        cstring_release(&text);
+}
+
+/* The schema's declaration of element `name`, a child of the element of
+ * frame `parent`, when the output is shaped by the schema. The children of
+ * an element the schema does not declare are not declared either. Names
+ * come from the reader's dictionary, so a repeated sibling is recognised
+ * by its address.
+ */
+static const struct xsd_element *element_decl(struct xml_stream *st,
+                                              struct stream_frame *parent,
+                                              const xmlChar *name)
+{
+        if (st->table == NULL)
+                return NULL;
+
+        if (parent->name && parent->decl == NULL)
+                return NULL;
+
+        if (parent->child_name == name)
+                return parent->child_decl;
+
+        parent->child_name = name;
+        parent->child_decl = xsd_table_lookup(st->table, parent->decl,
+                                              (const char *)name);
+
+        return parent->child_decl;
+}
+
+static int stream_run(struct xml_stream *st)
+{
+        xmlTextReaderPtr reader = st->reader;
+        int ret;
+
+        /* The document itself is the outermost frame */
+        push_frame(st);
+
+        for (;;) {
+                const struct xsd_element *decl;
+                struct stream_frame *f;
+                const xmlChar *name;
+                unsigned int shape;
+                int empty;
+
+                ret = xmlTextReaderRead(reader);
+                if (ret != 1)
+                        break;
+
+                f = &st->frames[st->nr_frames - 1];
+
+                switch (xmlTextReaderNodeType(reader)) {
+                case XML_READER_TYPE_ELEMENT:
+                        empty = xmlTextReaderIsEmptyElement(reader);
+                        shape = shape_get(&st->shape, st->element++);
+
+                        /* Children of text values are read, as they are
+                         * counted, but not written.
+                         */
+                        if (f->text_value || f->state == FRAME_SKIP) {
+                                f = push_frame(st);
+                                f->state = FRAME_SKIP;
+                                if (empty)
+                                        finish_frame(st, f);
+                                break;
+                        }
+
+                        name = xmlTextReaderConstLocalName(reader);
+                        decl = element_decl(st, f, name);
+                        start_child(st, f, name, decl, shape);
+                        f = push_frame(st);
+                        f->name = name;
+                        f->decl = decl;
+                        f->text_value = !!(shape & SHAPE_TEXT);
+                        read_attributes(st, f);
+                        if (empty)
+                                finish_frame(st, f);
+                        break;
+                case XML_READER_TYPE_END_ELEMENT:
+                        finish_frame(st, f);
+                        break;
+                case XML_READER_TYPE_TEXT:
+                        handle_text(st, f);
+                        break;
+                /* Other content makes an empty object, as in the DOM */
+                case XML_READER_TYPE_WHITESPACE:
+                case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
+                case XML_READER_TYPE_CDATA:
+                case XML_READER_TYPE_COMMENT:
+                case XML_READER_TYPE_PROCESSING_INSTRUCTION:
+                case XML_READER_TYPE_ENTITY_REFERENCE:
+                        if (f->state == FRAME_EMPTY)
+                                f->state = FRAME_BLANK;
+                        break;
+                default:
+                        break;
+                }
+        }
+
+        if (ret == 0 && st->nr_frames == 1) {
+                finish_frame(st, &st->frames[0]);
+                json_writer_addch(st->out, '\n');
+        }
+
+        return ret == 0 ? 0 : -1;
+}
+
+/*
+ * Public Functions
+ */
+
+int xml_stream_convert(const struct converter *conv, const char *filename,
+                       struct json_writer *out)
+{
+        struct xml_stream st;
+        off_t start;
+        size_t i;
+        int fd, ret = -1;
+
+        memset(&st, 0, sizeof(struct xml_stream));
+        st.out = out;
+        st.ws = conv->ws_mode;
+        st.infer_types = conv->infer_types;
+        st.xsd_types = conv->xsd_types;
+        st.xsd_arrays = conv->xsd_arrays;
+        if (st.xsd_types || st.xsd_arrays)
+                st.table = conv->table;
+
+        if (xml_input_is_stdin(filename))
+                fd = xml_input_rewindable(STDIN_FILENO);
+        else
+                fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+                perror(filename);
+                return -1;
+        }
+
+        /* A document which can't be read in full is still converted, for
+         * the second pass to report the errors.
+         */
+        start = lseek(fd, 0, SEEK_CUR);
+        shape_scan(&st.shape, fd, filename, conv->xml_options);
+
+        if (start < 0 || lseek(fd, start, SEEK_SET) < 0) {
+                perror(filename);
+                goto out;
+        }
+        st.reader = xmlReaderForFd(fd, filename, NULL, conv->xml_options);
+        if (st.reader == NULL)
+                goto out;
+
+        if (conv->vctxt == NULL ||
+            xmlTextReaderSchemaValidateCtxt(st.reader, conv->vctxt, 0) == 0)
+                ret = stream_run(&st);
+
+        xmlFreeTextReader(st.reader);
+
+out:
+        if (fd != STDIN_FILENO)
+                close(fd);
+
+        for (i = 0; i < st.init_frames; i++)
+                cstring_release(&st.frames[i].attrs);
+        free(st.frames);
+        free(st.attrs);
+        free(st.shape.bits);
+
+        return ret;
+}
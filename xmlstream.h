@@ -0,0 +1,49 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * xmlstream - convert XML to JSON while the input is being read.
+ */
+
+#ifndef XML2JSON_XMLSTREAM_H
+#define XML2JSON_XMLSTREAM_H
+
+#include "converter.h"
+#include "json.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* xml_stream_convert():
+ * Convert `filename` to JSON using libxml2's xmlTextReader and write the
+ * result to `w` as the document is read. The DOM is never built. A first
+ * SAX pass over the document records two bits per element: whether the
+ * next sibling has the same name, so the run becomes a JSON array, and
+ * whether the element has text, which is then its value. The second pass
+ * writes every value as it is read, keeping only the chain of currently
+ * open elements. Standard input which can't seek is copied to a temporary
+ * file for the second pass.
+ *
+ * The output is the same as the DOM based conversion, except that a name
+ * which repeats non-adjacently among siblings is emitted as a repeated key
+ * instead of being merged into one array.
+ *
+ * The options of `conv` apply as for the DOM conversion: text is
+ * normalised according to its `ws_mode`, typed with `infer_types` and
+ * `xsd_types`, and elements the schema lets repeat are arrays with
+ * `xsd_arrays`.
+ *
+ * If `conv` has a validation context, the document is validated against
+ * its schema by the reader as it goes; xmlSchemaIsValid(conv->vctxt)
+ * gives the result once this returns.
+ *
+ * Returns 0 on success and -1 if the document could not be parsed.
+ */
+extern int xml_stream_convert(const struct converter *conv,
+                              const char *filename, struct json_writer *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_XMLSTREAM_H */
@@ -0,0 +1,449 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * xsdtable - compact, mappable table of the elements declared by an XSD.
+ */
+
+#include "xsdtable.h"
+
+#include "cstring.h"
+#include "htable.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Strings added to a table being built, indexed by an open addressing
+ * hash of their offsets, so each one is stored once.
+ */
+struct string_pool {
+        cstring buf;
+        uint32_t *slots;                /* offset + 1, 0 when empty */
+        size_t size;
+        size_t nr;
+};
+
+static void string_pool_init(struct string_pool *pool)
+{
+        cstring_init(&pool->buf, 0);
+        pool->size = 64;
+        pool->nr = 0;
+        pool->slots = xcalloc(pool->size, sizeof(uint32_t));
+}
+
+static uint32_t *string_pool_slot(struct string_pool *pool, const char *str,
+                                  size_t len)
+{
+        size_t i = bufhash(str, len) & (pool->size - 1);
+
+        while (pool->slots[i]) {
+                const char *s = pool->buf.buf + pool->slots[i] - 1;
+
+                if (strcmp(s, str) == 0)
+                        break;
+                i = (i + 1) & (pool->size - 1);
+        }
+
+        return &pool->slots[i];
+}
+
+static void string_pool_grow(struct string_pool *pool)
+{
+        uint32_t *old = pool->slots;
+        size_t i, oldsize = pool->size;
+
+        pool->size *= 2;
+        pool->slots = xcalloc(pool->size, sizeof(uint32_t));
+
+        for (i = 0; i < oldsize; i++) {
+                const char *s;
+
+                if (!old[i])
+                        continue;
+                s = pool->buf.buf + old[i] - 1;
+                *string_pool_slot(pool, s, strlen(s)) = old[i];
+        }
+
+        free(old);
+}
+
+static uint32_t string_pool_add(struct string_pool *pool, const char *str)
+{
+        size_t len = strlen(str);
+        uint32_t *slot;
+
+        slot = string_pool_slot(pool, str, len);
+        if (*slot)
+                return *slot - 1;
+
+        *slot = pool->buf.len + 1;
+        cstring_add(&pool->buf, str, len + 1);
+
+        if (++pool->nr * 2 > pool->size)
+                string_pool_grow(pool);
+
+        return pool->buf.len - len - 1;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+        const char *p = buf;
+
+        while (len) {
+                ssize_t n = write(fd, p, len);
+
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                p += n;
+                len -= n;
+        }
+
+        return 0;
+}
+
+/* The value type of an XSD built-in type, "xs:" and its local name. Other
+ * types, including user defined simple types, are strings.
+ */
+static enum xsd_value_type value_type(const char *type)
+{
+        static const char *const integers[] = {
+                "integer", "int", "long", "short", "byte",
+                "nonNegativeInteger", "nonPositiveInteger",
+                "positiveInteger", "negativeInteger", "unsignedLong",
+                "unsignedInt", "unsignedShort", "unsignedByte",
+        };
+        size_t i;
+
+        if (strncmp(type, "xs:", 3) != 0)
+                return XSD_VALUE_STRING;
+        type += 3;
+
+        for (i = 0; i < ARRAY_SIZE(integers); i++) {
+                if (strcmp(type, integers[i]) == 0)
+                        return XSD_VALUE_INTEGER;
+        }
+        if (strcmp(type, "decimal") == 0)
+                return XSD_VALUE_DECIMAL;
+        if (strcmp(type, "float") == 0 || strcmp(type, "double") == 0)
+                return XSD_VALUE_FLOAT;
+        if (strcmp(type, "boolean") == 0)
+                return XSD_VALUE_BOOLEAN;
+
+        return XSD_VALUE_STRING;
+}
+
+static size_t key_hash(uint32_t scope, const char *name)
+{
+        return bufhash(name, strlen(name)) * 31 + scope * 0x9e3779b1U;
+}
+
+static struct xsd_table_key *key_slot(const struct xsd_table *table,
+                                      uint32_t scope, const char *name)
+{
+        size_t mask = table->keys_size - 1;
+        size_t i = key_hash(scope, name) & mask;
+
+        while (table->keys[i].element) {
+                const struct xsd_table_key *k = &table->keys[i];
+
+                if (k->scope == scope &&
+                    strcmp(xsd_table_str(table, k->name), name) == 0)
+                        break;
+                i = (i + 1) & mask;
+        }
+
+        return &table->keys[i];
+}
+
+/* Declarations seen first win, as they do when validating */
+static void key_add(struct xsd_table *table, uint32_t scope, uint32_t name,
+                    uint32_t element)
+{
+        struct xsd_table_key *k;
+
+        k = key_slot(table, scope, xsd_table_str(table, name));
+        if (k->element)
+                return;
+
+        k->scope = scope;
+        k->name = name;
+        k->element = element + 1;
+}
+
+/* Build the lookup index. Strings are stored once, so the scope of the
+ * elements declared in named type `T` is the offset of `T`, which is also
+ * the `type` of the elements of that type.
+ */
+static void xsd_table_index(struct xsd_table *table)
+{
+        uint32_t nr = table->nr_elements;
+        uint32_t i;
+
+        table->value_types = xmalloc(nr ? nr : 1);
+        for (i = 0; i < nr; i++) {
+                const struct xsd_element *e = &table->elements[i];
+
+                table->value_types[i] =
+                        value_type(xsd_table_str(table, e->type));
+        }
+
+        table->keys_size = 64;
+        while (table->keys_size < (size_t)nr * 2)
+                table->keys_size *= 2;
+        table->keys = xcalloc(table->keys_size, sizeof(struct xsd_table_key));
+
+        for (i = 0; i < nr; i++) {
+                const struct xsd_element *e = &table->elements[i];
+
+                key_add(table, e->scope, e->name, i);
+        }
+}
+
+static int xsd_table_check(const struct xsd_table *table)
+{
+        uint32_t i;
+
+        if (table->strings_len == 0 ||
+            table->strings[table->strings_len - 1] != '\0')
+                return -1;
+
+        for (i = 0; i < table->nr_elements; i++) {
+                const struct xsd_element *e = &table->elements[i];
+
+                if ((e->scope & XSD_SCOPE_ANON) ?
+                    (e->scope & ~XSD_SCOPE_ANON) >= table->nr_elements :
+                    e->scope >= table->strings_len)
+                        return -1;
+                if ((e->children & XSD_SCOPE_ANON) ?
+                    (e->children & ~XSD_SCOPE_ANON) >= table->nr_elements :
+                    e->children >= table->strings_len)
+                        return -1;
+                if (e->name >= table->strings_len ||
+                    e->type >= table->strings_len)
+                        return -1;
+        }
+
+        return 0;
+}
+
+/*
+ * Public Functions
+ */
+
+void xsd_table_build(struct xsd_table *table, const struct xsd_model *model)
+{
+        struct string_pool pool;
+        struct xsd_element *elements = NULL;
+        xmlArrayDefPtr def;
+        size_t nr = 0, alloc = 0;
+
+        string_pool_init(&pool);
+
+        /* Offset 0 is the empty string */
+        string_pool_add(&pool, "");
+
+        for (def = model->root; def; def = def->next) {
+                struct xsd_element *e;
+
+                ALLOC_GROW(elements, nr + 1, alloc);
+                e = &elements[nr++];
+                if (def->owner)
+                        e->scope = XSD_SCOPE_ANON | (uint32_t)(def->owner - 1);
+                else
+                        e->scope = string_pool_add(&pool,
+                                                   (char *)def->complexName);
+                e->name = string_pool_add(&pool, (char *)def->elemName);
+                e->type = string_pool_add(&pool, (char *)def->type);
+                if (def->type[0])
+                        e->children = e->type;
+                else
+                        e->children = XSD_SCOPE_ANON | (uint32_t)(nr - 1);
+                e->min_occurs = def->minOccurs;
+                e->max_occurs = def->maxOccurs;
+                e->array = def->isArray;
+        }
+
+        memset(table, 0, sizeof(struct xsd_table));
+        table->elements = elements;
+        table->nr_elements = nr;
+        table->strings_len = pool.buf.len;
+        table->strings = cstring_detach(&pool.buf, NULL);
+
+        free(pool.slots);
+
+        xsd_table_index(table);
+
+        /* References take the type of the global element, declared at the
+         * top level, once the index can find it.
+         */
+        for (def = model->root, nr = 0; def; def = def->next, nr++) {
+                const struct xsd_table_key *k;
+                const struct xsd_element *target;
+
+                if (def->ref == NULL)
+                        continue;
+
+                k = key_slot(table, 0, (char *)def->ref);
+                if (k->element == 0)
+                        continue;
+
+                target = &elements[k->element - 1];
+                elements[nr].type = target->type;
+                elements[nr].children = target->children;
+                table->value_types[nr] = table->value_types[k->element - 1];
+        }
+}
+
+int xsd_table_write(const struct xsd_table *table, const char *path)
+{
+        struct xsd_table_header hdr;
+        int fd, ret = 0;
+
+        memset(&hdr, 0, sizeof(struct xsd_table_header));
+        memcpy(hdr.magic, XSD_TABLE_MAGIC, sizeof(hdr.magic));
+        hdr.byte_order = XSD_TABLE_BYTE_ORDER;
+        hdr.version = XSD_TABLE_VERSION;
+        hdr.nr_elements = table->nr_elements;
+        hdr.strings_len = table->strings_len;
+
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+                return -1;
+
+        if (write_full(fd, &hdr, sizeof(hdr)) < 0 ||
+            write_full(fd, table->elements,
+                       table->nr_elements * sizeof(struct xsd_element)) < 0 ||
+            write_full(fd, table->strings, table->strings_len) < 0)
+                ret = -1;
+
+        if (close(fd) < 0)
+                ret = -1;
+        if (ret < 0)
+                unlink(path);
+
+        return ret;
+}
+
+int xsd_table_load(struct xsd_table *table, const char *path)
+{
+        const struct xsd_table_header *hdr;
+        struct stat st;
+        size_t len;
+        void *map;
+        int fd;
+
+        memset(table, 0, sizeof(struct xsd_table));
+
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return -1;
+
+        if (fstat(fd, &st) < 0 ||
+            (size_t)st.st_size < sizeof(struct xsd_table_header)) {
+                close(fd);
+                errno = EINVAL;
+                return -1;
+        }
+
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+                return -1;
+
+        hdr = map;
+        len = sizeof(struct xsd_table_header) +
+                (size_t)hdr->nr_elements * sizeof(struct xsd_element) +
+                hdr->strings_len;
+
+        table->map = map;
+        table->map_len = st.st_size;
+        table->elements = (const struct xsd_element *)(hdr + 1);
+        table->nr_elements = hdr->nr_elements;
+        table->strings = (const char *)(table->elements + hdr->nr_elements);
+        table->strings_len = hdr->strings_len;
+
+        if (memcmp(hdr->magic, XSD_TABLE_MAGIC, sizeof(hdr->magic)) ||
+            hdr->byte_order != XSD_TABLE_BYTE_ORDER ||
+            hdr->version != XSD_TABLE_VERSION ||
+            len != (size_t)st.st_size || xsd_table_check(table) < 0) {
+                xsd_table_release(table);
+                errno = EINVAL;
+                return -1;
+        }
+
+        xsd_table_index(table);
+
+        return 0;
+}
+
+enum scalar_type xsd_value_to_json(enum xsd_value_type type, char *s,
+                                   size_t *len)
+{
+        unsigned int parts = 0;
+        size_t n;
+        int b;
+
+        switch (type) {
+        case XSD_VALUE_BOOLEAN:
+                if ((b = scalar_xsd_boolean(s, *len)) < 0)
+                        return SCALAR_STRING;
+                *len = b ? 4 : 5;
+                memcpy(s, b ? "true" : "false", *len);
+                return SCALAR_BOOL;
+        case XSD_VALUE_FLOAT:
+                parts |= SCALAR_EXPONENT;
+                /* fall through */
+        case XSD_VALUE_DECIMAL:
+                parts |= SCALAR_FRACTION;
+                /* fall through */
+        case XSD_VALUE_INTEGER:
+                if ((n = scalar_xsd_number(s, *len, parts)) == 0)
+                        return SCALAR_STRING;
+                *len = n;
+                return SCALAR_NUMBER;
+        default:
+                return SCALAR_STRING;
+        }
+}
+
+const struct xsd_element *xsd_table_lookup(const struct xsd_table *table,
+                                           const struct xsd_element *parent,
+                                           const char *name)
+{
+        const struct xsd_table_key *k;
+        uint32_t scope = 0;
+
+        if (table->keys == NULL)
+                return NULL;
+
+        if (parent)
+                scope = parent->children;
+
+        k = key_slot(table, scope, name);
+        if (k->element == 0)
+                return NULL;
+
+        return &table->elements[k->element - 1];
+}
+
+void xsd_table_release(struct xsd_table *table)
+{
+        free(table->keys);
+        free(table->value_types);
+
+        if (table->map) {
+                munmap(table->map, table->map_len);
+        } else {
+                free((void *)(uintptr_t)table->elements);
+                free((void *)(uintptr_t)table->strings);
+        }
+
+        memset(table, 0, sizeof(struct xsd_table));
+}
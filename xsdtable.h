@@ -0,0 +1,168 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * xsdtable - compact, mappable table of the elements declared by an XSD.
+ */
+
+#ifndef XML2JSON_XSDTABLE_H
+#define XML2JSON_XSDTABLE_H
+
+#include "parsexsd.h"
+#include "scalar.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* File format, in host byte order:
+ *
+ *   struct xsd_table_header
+ *   struct xsd_element[nr_elements]
+ *   strings_len bytes of NUL terminated strings
+ *
+ * Strings are referred to by their offset in the string section, and are
+ * stored only once. Version 2 keys elements on their scope instead of the
+ * name of their complex type, version 3 adds the scope of their children,
+ * which follows references, and the elements of base types and groups.
+ * Tables of other versions are not loaded.
+ */
+#define XSD_TABLE_MAGIC "X2JXSDT"
+#define XSD_TABLE_VERSION 3
+#define XSD_TABLE_BYTE_ORDER 0x01020304
+
+struct xsd_table_header {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t version;
+        uint32_t nr_elements;
+        uint32_t strings_len;
+};
+
+/* The scope an element is declared in: the offset of the name of the
+ * named complex type declaring it, 0 (the empty string) for the top level
+ * of the schema, or XSD_SCOPE_ANON | the index of the element whose
+ * anonymous complex type declares it.
+ */
+#define XSD_SCOPE_ANON 0x80000000U
+
+struct xsd_element {
+        uint32_t scope;
+        uint32_t name;
+        uint32_t type;                  /* "xs:name" for built-in types,
+                                           the local name otherwise */
+        uint32_t children;              /* the scope of its children, that
+                                           of the global element for a
+                                           reference to one */
+        int32_t min_occurs;
+        int32_t max_occurs;
+        uint32_t array;                 /* enum arraytype */
+};
+
+/* The JSON type an element's text is written as, from its XSD type */
+enum xsd_value_type {
+        XSD_VALUE_STRING,
+        XSD_VALUE_INTEGER,              /* xs:integer, xs:int, xs:long... */
+        XSD_VALUE_DECIMAL,
+        XSD_VALUE_FLOAT,                /* xs:float and xs:double */
+        XSD_VALUE_BOOLEAN,
+};
+
+/* An element as it is looked up: by the scope of its declaration and its
+ * name, an offset in the string section.
+ */
+struct xsd_table_key {
+        uint32_t scope;
+        uint32_t name;
+        uint32_t element;               /* index + 1, 0 for an empty slot */
+};
+
+struct xsd_table {
+        const struct xsd_element *elements;
+        uint32_t nr_elements;
+        const char *strings;
+        uint32_t strings_len;
+
+        void *map;                      /* set when loaded from a file */
+        size_t map_len;
+
+        /* Built in memory whenever a table is built or loaded */
+        struct xsd_table_key *keys;     /* open addressing hash */
+        size_t keys_size;
+        uint8_t *value_types;           /* enum xsd_value_type per element */
+};
+
+/* xsd_table_build():
+ * Flatten the elements collected by walkXsdSchema() into `table`.
+ */
+extern void xsd_table_build(struct xsd_table *table,
+                            const struct xsd_model *model);
+
+/* xsd_table_write():
+ * Write `table` to `path`. Returns 0 on success, -1 on failure.
+ */
+extern int xsd_table_write(const struct xsd_table *table, const char *path);
+
+/* xsd_table_load():
+ * Map a table written by xsd_table_write(). The elements and strings are
+ * used in place, once checked for consistency; only the lookup index and
+ * the value types, one byte per element, are built in memory, as they are
+ * by xsd_table_build(). Returns 0 on success, -1 if the file can't be read
+ * or is not a valid table.
+ */
+extern int xsd_table_load(struct xsd_table *table, const char *path);
+
+/* xsd_table_release():
+ * Release the memory or the mapping held by `table`.
+ */
+extern void xsd_table_release(struct xsd_table *table);
+
+/* xsd_table_lookup():
+ * Returns the declaration of the element `name` as a child of an element
+ * declared by `parent`, NULL for the document, or NULL if the schema does
+ * not declare it. The children are those of the parent's type: the named
+ * complex type it refers to, or its anonymous one, so elements of the
+ * same name with different types have different children. A reference to
+ * a global element has the children of that element.
+ */
+extern const struct xsd_element *xsd_table_lookup(const struct xsd_table *table,
+                                                  const struct xsd_element *parent,
+                                                  const char *name);
+
+/* xsd_table_value_type():
+ * Returns the JSON type of the text of element `e`.
+ */
+static inline enum xsd_value_type
+xsd_table_value_type(const struct xsd_table *table,
+                     const struct xsd_element *e)
+{
+        return (enum xsd_value_type)table->value_types[e - table->elements];
+}
+
+/* xsd_value_to_json():
+ * Rewrite the `*len` bytes of text at `s`, the value of an element of
+ * type `type`, in place as the JSON value it is written as, and return
+ * its JSON type. Numbers are rewritten by scalar_xsd_number() and XSD
+ * booleans become "true" or "false", so `s` must have room for `*len` + 1
+ * bytes, and for at least 5. Text that is not a valid value of its type
+ * is left alone and is a string.
+ */
+extern enum scalar_type xsd_value_to_json(enum xsd_value_type type, char *s,
+                                          size_t *len);
+
+/* xsd_table_str():
+ * Returns the string at offset `off` of the table.
+ */
+static inline const char *xsd_table_str(const struct xsd_table *table,
+                                        uint32_t off)
+{
+        return table->strings + off;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_XSDTABLE_H */